@@ -1,45 +1,49 @@
 #'@useDynLib waddR
 #'@importFrom Rcpp sourceCpp
 #'@importFrom parallel nextRNGStream
-#'@importFrom methods is
-#'@importFrom stats binomial cor ecdf p.adjust pchisq quantile sd na.exclude
-#'@importFrom arm bayesglm
-#'@importFrom BiocParallel bplapply bpmapply
-#'@importFrom BiocFileCache BiocFileCache bfcadd bfcquery bfcdownload
-#'@importFrom BiocFileCache bfcpath bfcrpath bfccount bfcneedsupdate getBFCOption
+#'@importFrom methods as is
+#'@importFrom stats cor ecdf p.adjust pchisq quantile sd na.exclude
+#'@importFrom BiocParallel bpiterate bpmapply bpnworkers bpparam
 #'@importFrom SingleCellExperiment SingleCellExperiment counts logcounts
-#'@importFrom eva gpdAd gpdFit pgpd
+#'@importClassesFrom Matrix dgCMatrix
 NULL
 
 
 #' Compute value of the asymptotic CDF occuring in the asymptotic theory-based test
 #'
-#' Computes the values of the cumulative distribution function (CDF) of the integral over the squared standard Brownian bridge in the unit interval, where the computation is based on Monte Carlo simulations.
+#' Computes the values of the cumulative distribution function (CDF) of the integral over the squared standard Brownian bridge in the unit interval, where the computation is based on the series of Anderson and Darling (1952) and Smirnov (1936).
 #' This CDF occurs as an asymptotic distribution in the asymptotic theory-based test using the 2-Wasserstein distance, see Schefzik et al. (2020) for details. 
-#' It is used to determine the corresponding p-values in the function \code{.wassersteinTestAsy}.
+#' Its complement is used to determine the corresponding p-values in the function \code{.wassersteinTestAsy}, see \code{.brownianBridgePValue}.
 #'
 #' @param v a number
 #' @return Value at \code{v} of the asymptotic CDF
 #' @name .brownianBridgeEmpcdf
 #' 
 #'@references Schefzik, R., Flesch, J., and Goncalves, A. (2020). waddR: Using the 2-Wasserstein distance to identify differences between distributions in two-sample testing, with application to single-cell RNA-sequencing data.
-.brownianBridgeEmpcdf <- function(v) NULL # distribution loaded in .onLoad
+.brownianBridgeEmpcdf <- function(v) {
+    return(1 - .brownianBridgePValue(v))
+}
 
 
-# TODO: upload as data package
-#' URL for downloading the asymptotic CDF occuring in the asymptotic theory-based test
+#' Compute p-values of the asymptotic theory-based test
 #'
-#' URL for downloading the cumulative distribution function (CDF) of the integral over the squared standard Brownian bridge in the unit interval, where the computation is based on Monte Carlo simulations.
-#' This CDF occurs as an asymptotic distribution in the asymptotic theory-based test using the 2-Wasserstein distance, see Schefzik et al. (2020) for details. 
-#' It is used to determine the corresponding p-values in the function \code{.wassersteinTestAsy}.
-#' 
-#' @name brownianBridgeEmpcdf.url
-#' @docType data
+#' Computes the upper tail probabilities of the integral over the squared standard Brownian bridge in the unit interval, i.e. one minus the CDF computed by \code{.brownianBridgeEmpcdf}, without the loss of precision of small p-values in the subtraction.
+#' The probabilities are interpolated in a table, without any download.
+#' The table for the default precision is installed with the package and memory-mapped on the first call, so that nothing is loaded with the package and all R processes on a machine share its pages; tables of other precisions are computed once per session.
+#' The relative error of the interpolation is set by the option \code{waddR.asy.precision} (default \code{1e-6}); for \code{options(waddR.asy.precision=0)}, every value is computed from the series.
+#'
+#' @param v a number or a vector of numbers
+#' @return Probabilities that the integral over the squared standard Brownian bridge exceeds \code{v}
+#' @name .brownianBridgePValue
 #' 
-#'@references Schefzik, R., Flesch, J., and Goncalves, A. (2020). waddR: Using the 2-Wasserstein distance to identify differences between distributions in two-sample testing, with application to single-cell RNA-sequencing data.
-brownianBridgeEmpcdf.url <- paste0( "https://github.com/goncalves-lab/",
-                                    "waddR-data/blob/master/data/",
-                                    "empcdf_ref.RData?raw=true")
+#'@references Anderson, T. W. and Darling, D. A. (1952). Asymptotic theory of certain "goodness of fit" criteria based on stochastic processes. Annals of Mathematical Statistics, 23, 193-212.
+#'
+#' Smirnov, N. V. (1936). Sur la distribution de w2 (criterium de M. R. v. Mises). Comptes Rendus de l'Academie des Sciences, 202, 449-452.
+.brownianBridgePValue <- function(v) {
+    table <- system.file("extdata", "brownian_bridge_sf.bin", package="waddR")
+    return(brownian_bridge_sf(v, getOption("waddR.asy.precision", 1e-6),
+                              table))
+}
 
 
 # Non-exported definition to check if non-exported functions are available.
@@ -48,22 +52,6 @@ brownianBridgeEmpcdf.url <- paste0( "https://github.com/goncalves-lab/",
 NONEXPORTS.AVAILABLE <- TRUE
 
 
-.onLoad <- function (libname, pkgname) {
-
-    # Load the reference distributions from cache
-    if (is.null(.brownianBridgeEmpcdf(0))) {
-        brownianBridgeEmpcdf.path <- .cache.getOrDownload(
-            url=brownianBridgeEmpcdf.url,
-            rname="empcdf.ref")
-        empcdf.ref <- NULL # this variable will be loaded from the file
-        load(brownianBridgeEmpcdf.path)
-        assign(".brownianBridgeEmpcdf", 
-               empcdf.ref,
-               environment(.brownianBridgeEmpcdf))
-    }
-}
-
-
 # cleanup after our cpp libraries
 .onUnload <- function (libpath) {
     library.dynam.unload("waddR", libpath)
@@ -6,6 +6,174 @@
 
 using namespace Rcpp;
 
+// brownian_bridge_sf
+NumericVector brownian_bridge_sf(const NumericVector v, const double precision, const std::string table);
+RcppExport SEXP _waddR_brownian_bridge_sf(SEXP vSEXP, SEXP precisionSEXP, SEXP tableSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const NumericVector >::type v(vSEXP);
+    Rcpp::traits::input_parameter< const double >::type precision(precisionSEXP);
+    Rcpp::traits::input_parameter< const std::string >::type table(tableSEXP);
+    rcpp_result_gen = Rcpp::wrap(brownian_bridge_sf(v, precision, table));
+    return rcpp_result_gen;
+END_RCPP
+}
+// brownian_bridge_write_table
+int brownian_bridge_write_table(const std::string path, const double precision);
+RcppExport SEXP _waddR_brownian_bridge_write_table(SEXP pathSEXP, SEXP precisionSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const std::string >::type path(pathSEXP);
+    Rcpp::traits::input_parameter< const double >::type precision(precisionSEXP);
+    rcpp_result_gen = Rcpp::wrap(brownian_bridge_write_table(path, precision));
+    return rcpp_result_gen;
+END_RCPP
+}
+// checkpoint_open
+LogicalVector checkpoint_open(const std::string path, const int ngenes, const CharacterVector names, const std::string key);
+RcppExport SEXP _waddR_checkpoint_open(SEXP pathSEXP, SEXP ngenesSEXP, SEXP namesSEXP, SEXP keySEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const std::string >::type path(pathSEXP);
+    Rcpp::traits::input_parameter< const int >::type ngenes(ngenesSEXP);
+    Rcpp::traits::input_parameter< const CharacterVector >::type names(namesSEXP);
+    Rcpp::traits::input_parameter< const std::string >::type key(keySEXP);
+    rcpp_result_gen = Rcpp::wrap(checkpoint_open(path, ngenes, names, key));
+    return rcpp_result_gen;
+END_RCPP
+}
+// checkpoint_append
+int checkpoint_append(const std::string path, const IntegerVector genes, const NumericMatrix values);
+RcppExport SEXP _waddR_checkpoint_append(SEXP pathSEXP, SEXP genesSEXP, SEXP valuesSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const std::string >::type path(pathSEXP);
+    Rcpp::traits::input_parameter< const IntegerVector >::type genes(genesSEXP);
+    Rcpp::traits::input_parameter< const NumericMatrix >::type values(valuesSEXP);
+    rcpp_result_gen = Rcpp::wrap(checkpoint_append(path, genes, values));
+    return rcpp_result_gen;
+END_RCPP
+}
+// checkpoint_collect
+List checkpoint_collect(const std::string path, const int pcol, Nullable<NumericVector> pzero);
+RcppExport SEXP _waddR_checkpoint_collect(SEXP pathSEXP, SEXP pcolSEXP, SEXP pzeroSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const std::string >::type path(pathSEXP);
+    Rcpp::traits::input_parameter< const int >::type pcol(pcolSEXP);
+    Rcpp::traits::input_parameter< Nullable<NumericVector> >::type pzero(pzeroSEXP);
+    rcpp_result_gen = Rcpp::wrap(checkpoint_collect(path, pcol, pzero));
+    return rcpp_result_gen;
+END_RCPP
+}
+// gpd_fit
+NumericVector gpd_fit(const NumericVector y);
+RcppExport SEXP _waddR_gpd_fit(SEXP ySEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const NumericVector >::type y(ySEXP);
+    rcpp_result_gen = Rcpp::wrap(gpd_fit(y));
+    return rcpp_result_gen;
+END_RCPP
+}
+// gpd_ad_test
+NumericVector gpd_ad_test(const NumericVector x);
+RcppExport SEXP _waddR_gpd_ad_test(SEXP xSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const NumericVector >::type x(xSEXP);
+    rcpp_result_gen = Rcpp::wrap(gpd_ad_test(x));
+    return rcpp_result_gen;
+END_RCPP
+}
+// gpd_fitted_pvalue
+NumericVector gpd_fitted_pvalue(const double val, const NumericVector distr_ordered, const double bsn);
+RcppExport SEXP _waddR_gpd_fitted_pvalue(SEXP valSEXP, SEXP distr_orderedSEXP, SEXP bsnSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const double >::type val(valSEXP);
+    Rcpp::traits::input_parameter< const NumericVector >::type distr_ordered(distr_orderedSEXP);
+    Rcpp::traits::input_parameter< const double >::type bsn(bsnSEXP);
+    rcpp_result_gen = Rcpp::wrap(gpd_fitted_pvalue(val, distr_ordered, bsn));
+    return rcpp_result_gen;
+END_RCPP
+}
+// profile_clock
+double profile_clock();
+RcppExport SEXP _waddR_profile_clock() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    rcpp_result_gen = Rcpp::wrap(profile_clock());
+    return rcpp_result_gen;
+END_RCPP
+}
+// profile_peak_rss
+double profile_peak_rss();
+RcppExport SEXP _waddR_profile_peak_rss() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    rcpp_result_gen = Rcpp::wrap(profile_peak_rss());
+    return rcpp_result_gen;
+END_RCPP
+}
+// sparse_csr
+List sparse_csr(const S4 m);
+RcppExport SEXP _waddR_sparse_csr(SEXP mSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const S4 >::type m(mSEXP);
+    rcpp_result_gen = Rcpp::wrap(sparse_csr(m));
+    return rcpp_result_gen;
+END_RCPP
+}
+// sparse_row
+NumericVector sparse_row(const List csr, const int row);
+RcppExport SEXP _waddR_sparse_row(SEXP csrSEXP, SEXP rowSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const List >::type csr(csrSEXP);
+    Rcpp::traits::input_parameter< const int >::type row(rowSEXP);
+    rcpp_result_gen = Rcpp::wrap(sparse_row(csr, row));
+    return rcpp_result_gen;
+END_RCPP
+}
+// sparse_row_split
+List sparse_row_split(const List csr, const int row, const IntegerVector group, const bool inclZero);
+RcppExport SEXP _waddR_sparse_row_split(SEXP csrSEXP, SEXP rowSEXP, SEXP groupSEXP, SEXP inclZeroSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const List >::type csr(csrSEXP);
+    Rcpp::traits::input_parameter< const int >::type row(rowSEXP);
+    Rcpp::traits::input_parameter< const IntegerVector >::type group(groupSEXP);
+    Rcpp::traits::input_parameter< const bool >::type inclZero(inclZeroSEXP);
+    rcpp_result_gen = Rcpp::wrap(sparse_row_split(csr, row, group, inclZero));
+    return rcpp_result_gen;
+END_RCPP
+}
+// sparse_detection
+NumericVector sparse_detection(const S4 m);
+RcppExport SEXP _waddR_sparse_detection(SEXP mSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const S4 >::type m(mSEXP);
+    rcpp_result_gen = Rcpp::wrap(sparse_detection(m));
+    return rcpp_result_gen;
+END_RCPP
+}
 // permutations
 NumericMatrix permutations(const NumericVector x, const int num_permutations);
 RcppExport SEXP _waddR_permutations(SEXP xSEXP, SEXP num_permutationsSEXP) {
@@ -18,42 +186,148 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// prepare_sample
+SEXP prepare_sample(const NumericVector x);
+RcppExport SEXP _waddR_prepare_sample(SEXP xSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const NumericVector >::type x(xSEXP);
+    rcpp_result_gen = Rcpp::wrap(prepare_sample(x));
+    return rcpp_result_gen;
+END_RCPP
+}
+// quantile_correlation
+double quantile_correlation(SEXP x, SEXP y);
+RcppExport SEXP _waddR_quantile_correlation(SEXP xSEXP, SEXP ySEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type x(xSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type y(ySEXP);
+    rcpp_result_gen = Rcpp::wrap(quantile_correlation(x, y));
+    return rcpp_result_gen;
+END_RCPP
+}
 // squared_wass_decomp
-Rcpp::List squared_wass_decomp(const NumericVector& x, const NumericVector& y);
+Rcpp::List squared_wass_decomp(SEXP x, SEXP y);
 RcppExport SEXP _waddR_squared_wass_decomp(SEXP xSEXP, SEXP ySEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< const NumericVector& >::type x(xSEXP);
-    Rcpp::traits::input_parameter< const NumericVector& >::type y(ySEXP);
+    Rcpp::traits::input_parameter< SEXP >::type x(xSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type y(ySEXP);
     rcpp_result_gen = Rcpp::wrap(squared_wass_decomp(x, y));
     return rcpp_result_gen;
 END_RCPP
 }
 // squared_wass_approx
-double squared_wass_approx(const NumericVector& x, const NumericVector& y);
+double squared_wass_approx(SEXP x, SEXP y);
 RcppExport SEXP _waddR_squared_wass_approx(SEXP xSEXP, SEXP ySEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< const NumericVector& >::type x(xSEXP);
-    Rcpp::traits::input_parameter< const NumericVector& >::type y(ySEXP);
+    Rcpp::traits::input_parameter< SEXP >::type x(xSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type y(ySEXP);
     rcpp_result_gen = Rcpp::wrap(squared_wass_approx(x, y));
     return rcpp_result_gen;
 END_RCPP
 }
 // wasserstein_metric
-double wasserstein_metric(const NumericVector x, const NumericVector y, const double p, const Nullable<NumericVector> wa_, const Nullable<NumericVector> wb_);
-RcppExport SEXP _waddR_wasserstein_metric(SEXP xSEXP, SEXP ySEXP, SEXP pSEXP, SEXP wa_SEXP, SEXP wb_SEXP) {
+double wasserstein_metric(SEXP x, SEXP y, const double p, const Nullable<NumericVector> wa_, const Nullable<NumericVector> wb_, const bool collapse_ties);
+RcppExport SEXP _waddR_wasserstein_metric(SEXP xSEXP, SEXP ySEXP, SEXP pSEXP, SEXP wa_SEXP, SEXP wb_SEXP, SEXP collapse_tiesSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< const NumericVector >::type x(xSEXP);
-    Rcpp::traits::input_parameter< const NumericVector >::type y(ySEXP);
+    Rcpp::traits::input_parameter< SEXP >::type x(xSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type y(ySEXP);
     Rcpp::traits::input_parameter< const double >::type p(pSEXP);
     Rcpp::traits::input_parameter< const Nullable<NumericVector> >::type wa_(wa_SEXP);
     Rcpp::traits::input_parameter< const Nullable<NumericVector> >::type wb_(wb_SEXP);
-    rcpp_result_gen = Rcpp::wrap(wasserstein_metric(x, y, p, wa_, wb_));
+    Rcpp::traits::input_parameter< const bool >::type collapse_ties(collapse_tiesSEXP);
+    rcpp_result_gen = Rcpp::wrap(wasserstein_metric(x, y, p, wa_, wb_, collapse_ties));
+    return rcpp_result_gen;
+END_RCPP
+}
+// wass_statistics
+NumericVector wass_statistics(SEXP x, SEXP y, const bool relative_to_comp);
+RcppExport SEXP _waddR_wass_statistics(SEXP xSEXP, SEXP ySEXP, SEXP relative_to_compSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type x(xSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type y(ySEXP);
+    Rcpp::traits::input_parameter< const bool >::type relative_to_comp(relative_to_compSEXP);
+    rcpp_result_gen = Rcpp::wrap(wass_statistics(x, y, relative_to_comp));
+    return rcpp_result_gen;
+END_RCPP
+}
+// asy_test_statistic
+double asy_test_statistic(SEXP x, SEXP y);
+RcppExport SEXP _waddR_asy_test_statistic(SEXP xSEXP, SEXP ySEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type x(xSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type y(ySEXP);
+    rcpp_result_gen = Rcpp::wrap(asy_test_statistic(x, y));
+    return rcpp_result_gen;
+END_RCPP
+}
+// wass_permutations
+SEXP wass_permutations(const NumericVector x, const NumericVector y, const int num_permutations, const double value_sq, const int tail_size, const int threads, const int max_exceedances, const double alpha, const Nullable<List> labels);
+RcppExport SEXP _waddR_wass_permutations(SEXP xSEXP, SEXP ySEXP, SEXP num_permutationsSEXP, SEXP value_sqSEXP, SEXP tail_sizeSEXP, SEXP threadsSEXP, SEXP max_exceedancesSEXP, SEXP alphaSEXP, SEXP labelsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const NumericVector >::type x(xSEXP);
+    Rcpp::traits::input_parameter< const NumericVector >::type y(ySEXP);
+    Rcpp::traits::input_parameter< const int >::type num_permutations(num_permutationsSEXP);
+    Rcpp::traits::input_parameter< const double >::type value_sq(value_sqSEXP);
+    Rcpp::traits::input_parameter< const int >::type tail_size(tail_sizeSEXP);
+    Rcpp::traits::input_parameter< const int >::type threads(threadsSEXP);
+    Rcpp::traits::input_parameter< const int >::type max_exceedances(max_exceedancesSEXP);
+    Rcpp::traits::input_parameter< const double >::type alpha(alphaSEXP);
+    Rcpp::traits::input_parameter< const Nullable<List> >::type labels(labelsSEXP);
+    rcpp_result_gen = Rcpp::wrap(wass_permutations(x, y, num_permutations, value_sq, tail_size, threads, max_exceedances, alpha, labels));
+    return rcpp_result_gen;
+END_RCPP
+}
+// permutation_labels
+List permutation_labels(const int n_x, const int n_y, const int num_permutations);
+RcppExport SEXP _waddR_permutation_labels(SEXP n_xSEXP, SEXP n_ySEXP, SEXP num_permutationsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const int >::type n_x(n_xSEXP);
+    Rcpp::traits::input_parameter< const int >::type n_y(n_ySEXP);
+    Rcpp::traits::input_parameter< const int >::type num_permutations(num_permutationsSEXP);
+    rcpp_result_gen = Rcpp::wrap(permutation_labels(n_x, n_y, num_permutations));
+    return rcpp_result_gen;
+END_RCPP
+}
+// sketch_sample
+SEXP sketch_sample(const NumericVector x, const double epsilon, const int threads);
+RcppExport SEXP _waddR_sketch_sample(SEXP xSEXP, SEXP epsilonSEXP, SEXP threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const NumericVector >::type x(xSEXP);
+    Rcpp::traits::input_parameter< const double >::type epsilon(epsilonSEXP);
+    Rcpp::traits::input_parameter< const int >::type threads(threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(sketch_sample(x, epsilon, threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// merge_sketches
+SEXP merge_sketches(SEXP x, SEXP y);
+RcppExport SEXP _waddR_merge_sketches(SEXP xSEXP, SEXP ySEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type x(xSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type y(ySEXP);
+    rcpp_result_gen = Rcpp::wrap(merge_sketches(x, y));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -285,12 +559,64 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// logistic_zero_test
+NumericVector logistic_zero_test(const List csr, const NumericVector detection, const IntegerVector group, const IntegerVector rows, const int threads);
+RcppExport SEXP _waddR_logistic_zero_test(SEXP csrSEXP, SEXP detectionSEXP, SEXP groupSEXP, SEXP rowsSEXP, SEXP threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const List >::type csr(csrSEXP);
+    Rcpp::traits::input_parameter< const NumericVector >::type detection(detectionSEXP);
+    Rcpp::traits::input_parameter< const IntegerVector >::type group(groupSEXP);
+    Rcpp::traits::input_parameter< const IntegerVector >::type rows(rowsSEXP);
+    Rcpp::traits::input_parameter< const int >::type threads(threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(logistic_zero_test(csr, detection, group, rows, threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// logistic_zero_test_dense
+NumericVector logistic_zero_test_dense(const NumericMatrix m, const NumericVector detection, const IntegerVector group, const IntegerVector rows, const int threads);
+RcppExport SEXP _waddR_logistic_zero_test_dense(SEXP mSEXP, SEXP detectionSEXP, SEXP groupSEXP, SEXP rowsSEXP, SEXP threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const NumericMatrix >::type m(mSEXP);
+    Rcpp::traits::input_parameter< const NumericVector >::type detection(detectionSEXP);
+    Rcpp::traits::input_parameter< const IntegerVector >::type group(groupSEXP);
+    Rcpp::traits::input_parameter< const IntegerVector >::type rows(rowsSEXP);
+    Rcpp::traits::input_parameter< const int >::type threads(threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(logistic_zero_test_dense(m, detection, group, rows, threads));
+    return rcpp_result_gen;
+END_RCPP
+}
 
 static const R_CallMethodDef CallEntries[] = {
+    {"_waddR_brownian_bridge_sf", (DL_FUNC) &_waddR_brownian_bridge_sf, 3},
+    {"_waddR_brownian_bridge_write_table", (DL_FUNC) &_waddR_brownian_bridge_write_table, 2},
+    {"_waddR_checkpoint_open", (DL_FUNC) &_waddR_checkpoint_open, 4},
+    {"_waddR_checkpoint_append", (DL_FUNC) &_waddR_checkpoint_append, 3},
+    {"_waddR_checkpoint_collect", (DL_FUNC) &_waddR_checkpoint_collect, 3},
+    {"_waddR_gpd_fit", (DL_FUNC) &_waddR_gpd_fit, 1},
+    {"_waddR_gpd_ad_test", (DL_FUNC) &_waddR_gpd_ad_test, 1},
+    {"_waddR_gpd_fitted_pvalue", (DL_FUNC) &_waddR_gpd_fitted_pvalue, 3},
+    {"_waddR_profile_clock", (DL_FUNC) &_waddR_profile_clock, 0},
+    {"_waddR_profile_peak_rss", (DL_FUNC) &_waddR_profile_peak_rss, 0},
+    {"_waddR_sparse_csr", (DL_FUNC) &_waddR_sparse_csr, 1},
+    {"_waddR_sparse_row", (DL_FUNC) &_waddR_sparse_row, 2},
+    {"_waddR_sparse_row_split", (DL_FUNC) &_waddR_sparse_row_split, 4},
+    {"_waddR_sparse_detection", (DL_FUNC) &_waddR_sparse_detection, 1},
     {"_waddR_permutations", (DL_FUNC) &_waddR_permutations, 2},
+    {"_waddR_prepare_sample", (DL_FUNC) &_waddR_prepare_sample, 1},
+    {"_waddR_quantile_correlation", (DL_FUNC) &_waddR_quantile_correlation, 2},
     {"_waddR_squared_wass_decomp", (DL_FUNC) &_waddR_squared_wass_decomp, 2},
     {"_waddR_squared_wass_approx", (DL_FUNC) &_waddR_squared_wass_approx, 2},
-    {"_waddR_wasserstein_metric", (DL_FUNC) &_waddR_wasserstein_metric, 5},
+    {"_waddR_wasserstein_metric", (DL_FUNC) &_waddR_wasserstein_metric, 6},
+    {"_waddR_wass_statistics", (DL_FUNC) &_waddR_wass_statistics, 3},
+    {"_waddR_asy_test_statistic", (DL_FUNC) &_waddR_asy_test_statistic, 2},
+    {"_waddR_wass_permutations", (DL_FUNC) &_waddR_wass_permutations, 9},
+    {"_waddR_permutation_labels", (DL_FUNC) &_waddR_permutation_labels, 3},
+    {"_waddR_sketch_sample", (DL_FUNC) &_waddR_sketch_sample, 3},
+    {"_waddR_merge_sketches", (DL_FUNC) &_waddR_merge_sketches, 2},
     {"_waddR_add_test_export", (DL_FUNC) &_waddR_add_test_export, 2},
     {"_waddR_add_test_export_sv", (DL_FUNC) &_waddR_add_test_export_sv, 2},
     {"_waddR_multiply_test_export", (DL_FUNC) &_waddR_multiply_test_export, 2},
@@ -310,6 +636,8 @@ static const R_CallMethodDef CallEntries[] = {
     {"_waddR_interval_table_test_export", (DL_FUNC) &_waddR_interval_table_test_export, 3},
     {"_waddR_equidist_quantile_test_export", (DL_FUNC) &_waddR_equidist_quantile_test_export, 4},
     {"_waddR_quantile_test_export", (DL_FUNC) &_waddR_quantile_test_export, 3},
+    {"_waddR_logistic_zero_test", (DL_FUNC) &_waddR_logistic_zero_test, 5},
+    {"_waddR_logistic_zero_test_dense", (DL_FUNC) &_waddR_logistic_zero_test_dense, 5},
     {NULL, NULL, 0}
 };
 
@@ -0,0 +1,386 @@
+// [[Rcpp::depends(RcppArmadillo)]]
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <RcppArmadillo.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace Rcpp;
+
+
+
+/*=============================================
+
+			ASYMPTOTIC DISTRIBUTION
+
+==============================================*/
+
+// The test statistic of the asymptotic test converges in distribution to
+// W = int_0^1 B(t)^2 dt, the integral over the squared standard Brownian
+// bridge B, which is also the limit of the Cramer-von Mises statistic. Its
+// distribution is known analytically: the cdf has the series of Anderson and
+// Darling (1952) in the modified Bessel function K_{1/4}, and the upper tail
+// follows from the eigen-expansion W = sum_k Z_k^2 / (k pi)^2 (Smirnov,
+// 1936). p-values are interpolated in a table of log P(W > v), which is
+// built on first use for the requested precision, so no reference
+// distribution has to be simulated or downloaded. The table for the default
+// precision is installed with the package as a flat binary file, which is
+// memory-mapped on first use instead of being computed in every session.
+
+// below this value, P(W > v) = 1 - cdf is taken from the Bessel series
+const double SERIES_BELOW = 0.2;
+
+// P(W > 140) is about 3e-302; larger values are evaluated directly
+const double TABLE_END = 140.0;
+
+// Layout of table files, in native byte order: the magic string, the
+// precision, the number n of nodes, then the n nodes and the n values of
+// log P(W > v)
+const char TABLE_MAGIC[] = "WADDRBB1";
+const size_t TABLE_HEADER_SIZE = 8 + sizeof(double) + sizeof(uint64_t);
+
+
+//' brownian_bridge_cdf_series
+//'
+//' Series of Anderson and Darling (1952) for P(W <= v):
+//' 1/(pi sqrt(v)) sum_j Gamma(j+1/2)/(Gamma(1/2) j!) sqrt(4j+1)
+//' exp(-u_j) K_{1/4}(u_j) with u_j = (4j+1)^2/(16v)
+//'
+//' @param v positive value
+//' @return P(W <= v)
+//'
+double brownian_bridge_cdf_series(const double v)
+{
+	double 	sum = 0.0,
+			coef = 1.0;		// Gamma(j+1/2)/(Gamma(1/2) j!)
+	for (int j=0; j<1000; j++) {
+		if (j > 0) {
+			coef *= (2.0 * j - 1) / (2.0 * j);
+		}
+		const double u = (4.0 * j + 1) * (4.0 * j + 1) / (16 * v);
+		// the exponentially scaled K_{1/4}(u) is exp(u) K_{1/4}(u)
+		const double term = coef * sqrt(4.0 * j + 1)
+							* R::bessel_k(u, 0.25, 2.0) * exp(-2 * u);
+		sum += term;
+		if (term <= 1e-17 * sum) {
+			break;
+		}
+	}
+	return sum / (M_PI * sqrt(v));
+}
+
+
+//' brownian_bridge_sf_smirnov
+//'
+//' Upper tail of Smirnov (1936):
+//' P(W > v) = 1/pi sum_k (-1)^(k+1) int_{(2k-1)pi}^{2k pi}
+//' 2 exp(-u^2 v/2) / sqrt(-u sin(u)) du.
+//' The integrals have inverse square root singularities at both ends and
+//' are evaluated by tanh-sinh quadrature, whose nodes cluster at the ends.
+//'
+//' @param v positive value
+//' @return P(W > v)
+//'
+double brownian_bridge_sf_smirnov(const double v)
+{
+	const double 	h = 1.0 / 32,		// step of the quadrature
+					t_max = 4.5,		// nodes beyond add less than 1e-60
+					r = M_PI / 2;		// half-width of the intervals
+	double sf = 0.0;
+
+	for (int k=1; k<1000; k++) {
+		const double lower = (2 * k - 1) * M_PI;
+		double integral = 0.0;
+		for (double t=-t_max; t<=t_max; t+=h) {
+			const double s = M_PI / 2 * sinh(t);
+			// distances of the node to both ends, without cancellation;
+			// -sin(u) = sin(to_lower) = sin(to_upper)
+			const double 	to_lower = 2 * r / (1 + exp(-2 * s)),
+							to_upper = 2 * r / (1 + exp(2 * s)),
+							u = lower + to_lower,
+							weight = r * M_PI / 2 * cosh(t) / (cosh(s) * cosh(s));
+			if (to_lower <= 0 || to_upper <= 0 || weight == 0) {
+				continue;
+			}
+			integral += weight * 2 * exp(-u * u * v / 2)
+						/ sqrt(u * sin(min(to_lower, to_upper)));
+		}
+		integral *= h / M_PI;
+		sf += (k % 2 == 1) ? integral : -integral;
+		if (integral <= 1e-17 * sf) {
+			break;
+		}
+	}
+	return sf;
+}
+
+
+//' brownian_bridge_sf_exact
+//'
+//' @param v value
+//' @return P(W > v), from the Bessel series for small v and from the
+//'  expansion of Smirnov for the tail, with a relative error of about 1e-12
+//'
+double brownian_bridge_sf_exact(const double v)
+{
+	if (v <= 0) {
+		return 1.0;
+	}
+	if (v < SERIES_BELOW) {
+		return 1.0 - brownian_bridge_cdf_series(v);
+	}
+	return brownian_bridge_sf_smirnov(v);
+}
+
+
+//' brownian_bridge_table
+//'
+//' Table of log P(W > v) on [0, TABLE_END] for linear interpolation. The
+//' intervals are bisected until the interpolation error at their midpoint
+//' and quarter points is below the precision; as the error of
+//' log P(W > v) is the relative error of P(W > v), the interpolated
+//' p-values have about this relative error.
+//'
+//' The nodes are either computed (computed_v, computed_log_sf) or read from
+//' a memory-mapped table file; v and log_sf point to either.
+//'
+struct brownian_bridge_table
+{
+	double 			precision;
+	const double 	*v,				// n increasing nodes
+					*log_sf;		// log P(W > v) at the nodes
+	size_t 			n;
+	vector<double> 	computed_v,
+					computed_log_sf;
+	void 			*mapped;
+	size_t 			mapped_size;
+
+	explicit brownian_bridge_table(const double precision)
+		: precision(precision), mapped(nullptr), mapped_size(0)
+	{
+		const double step = 0.25;
+		double 	lower = 0.0,
+				log_lower = 0.0;
+		computed_v.push_back(lower);
+		computed_log_sf.push_back(log_lower);
+		for (double upper=step; upper<=TABLE_END; upper+=step) {
+			const double log_upper = log(brownian_bridge_sf_exact(upper));
+			refine(lower, log_lower, upper, log_upper,
+				   log(brownian_bridge_sf_exact(lower + step / 2)));
+			computed_v.push_back(upper);
+			computed_log_sf.push_back(log_upper);
+			lower = upper;
+			log_lower = log_upper;
+		}
+		v = computed_v.data();
+		log_sf = computed_log_sf.data();
+		n = computed_v.size();
+	}
+
+	~brownian_bridge_table()
+	{
+#ifndef _WIN32
+		if (mapped) {
+			munmap(mapped, mapped_size);
+		}
+#endif
+	}
+
+	brownian_bridge_table(const brownian_bridge_table&) = delete;
+	brownian_bridge_table& operator=(const brownian_bridge_table&) = delete;
+
+	// adds the nodes within (lower, upper) in increasing order; the values
+	// at the quarter points are the midpoints of the halves, so that every
+	// value is computed once
+	void refine(const double lower, const double log_lower,
+				const double upper, const double log_upper,
+				const double log_mid)
+	{
+		const double 	mid = (lower + upper) / 2,
+						log_q1 = log(brownian_bridge_sf_exact((lower + mid) / 2)),
+						log_q3 = log(brownian_bridge_sf_exact((mid + upper) / 2)),
+						slope = (log_upper - log_lower) / 4;
+		const bool fits = abs(log_mid - (log_lower + 2 * slope)) <= precision
+						&& abs(log_q1 - (log_lower + slope)) <= precision
+						&& abs(log_q3 - (log_lower + 3 * slope)) <= precision;
+		if (fits || upper - lower <= 1e-6) {
+			return;
+		}
+		refine(lower, log_lower, mid, log_mid, log_q1);
+		computed_v.push_back(mid);
+		computed_log_sf.push_back(log_mid);
+		refine(mid, log_mid, upper, log_upper, log_q3);
+	}
+
+	// P(W > x) by linear interpolation of log P(W > v)
+	double sf(const double x) const
+	{
+		if (x <= 0) {
+			return 1.0;
+		}
+		if (x >= TABLE_END) {
+			return brownian_bridge_sf_exact(x);
+		}
+		const int i = upper_bound(v, v + n, x) - v - 1;
+		const double w = (x - v[i]) / (v[i+1] - v[i]);
+		return exp(log_sf[i] + w * (log_sf[i+1] - log_sf[i]));
+	}
+
+	// maps a table file read-only, so that all processes using the file
+	// share its pages; returns nullptr if the file is missing, invalid or
+	// of another precision
+	static brownian_bridge_table* map(const string& path,
+									  const double precision)
+	{
+#ifdef _WIN32
+		return nullptr;
+#else
+		const int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0) {
+			return nullptr;
+		}
+		struct stat st;
+		void *mapped = MAP_FAILED;
+		if (fstat(fd, &st) == 0 && (size_t) st.st_size >= TABLE_HEADER_SIZE) {
+			mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		}
+		close(fd);
+		if (mapped == MAP_FAILED) {
+			return nullptr;
+		}
+
+		const char *bytes = static_cast<const char*>(mapped);
+		double file_precision;
+		uint64_t file_n;
+		memcpy(&file_precision, bytes + 8, sizeof(double));
+		memcpy(&file_n, bytes + 8 + sizeof(double), sizeof(uint64_t));
+		if (memcmp(bytes, TABLE_MAGIC, 8) != 0 || file_precision != precision
+			|| file_n < 2
+			|| (size_t) st.st_size != TABLE_HEADER_SIZE + 2 * file_n * sizeof(double)) {
+			munmap(mapped, st.st_size);
+			return nullptr;
+		}
+
+		brownian_bridge_table *table = new brownian_bridge_table();
+		table->precision = precision;
+		table->mapped = mapped;
+		table->mapped_size = st.st_size;
+		table->n = file_n;
+		table->v = reinterpret_cast<const double*>(bytes + TABLE_HEADER_SIZE);
+		table->log_sf = table->v + file_n;
+		return table;
+#endif
+	}
+
+	// writes the table in the layout read by map()
+	void write(const string& path) const
+	{
+		FILE *file = fopen(path.c_str(), "wb");
+		if (!file) {
+			stop("brownian_bridge_table: Cannot open " + path);
+		}
+		const uint64_t file_n = n;
+		bool written = fwrite(TABLE_MAGIC, 1, 8, file) == 8
+					&& fwrite(&precision, sizeof(double), 1, file) == 1
+					&& fwrite(&file_n, sizeof(uint64_t), 1, file) == 1
+					&& fwrite(v, sizeof(double), n, file) == n
+					&& fwrite(log_sf, sizeof(double), n, file) == n;
+		written = (fclose(file) == 0) && written;
+		if (!written) {
+			stop("brownian_bridge_table: Cannot write " + path);
+		}
+	}
+
+private:
+	brownian_bridge_table()
+		: precision(0), v(nullptr), log_sf(nullptr), n(0),
+		  mapped(nullptr), mapped_size(0) {}
+};
+
+
+//' Upper tail of the asymptotic distribution of the asymptotic test
+//'
+//' Computes \eqn{P(W > v)} for the integral \eqn{W} over the squared
+//' standard Brownian bridge in the unit interval, i.e. the p-value of the
+//' asymptotic theory-based test for the test statistic \eqn{v}.
+//'
+//' The probabilities are interpolated in a table from the series of
+//' Anderson and Darling (1952) and Smirnov (1936). On the first call with a
+//' precision, the table is memory-mapped from the file \code{table} if it
+//' holds a table of this precision (see \code{brownian_bridge_write_table}),
+//' and computed otherwise. It is kept for further calls with the same
+//' precision.
+//'
+//' @param v vector of values of the test statistic
+//' @param precision relative error of the interpolated probabilities; if 0,
+//'  the series are evaluated for every value, without the table. Default is
+//'  1e-6
+//' @param table path of a table file; if empty or not matching, the table
+//'  is computed
+//' @return vector of \eqn{P(W > v)}
+//'
+//' @references Anderson, T. W. and Darling, D. A. (1952). Asymptotic theory of certain "goodness of fit" criteria based on stochastic processes. Annals of Mathematical Statistics, 23, 193-212.
+//'
+//' Smirnov, N. V. (1936). Sur la distribution de w2 (criterium de M. R. v. Mises). Comptes Rendus de l'Academie des Sciences, 202, 449-452.
+//'
+//[[Rcpp::export]]
+NumericVector brownian_bridge_sf(const NumericVector v,
+								 const double precision=1e-6,
+								 const std::string table="")
+{
+	if (!(precision >= 0)) {
+		stop("brownian_bridge_sf: Precision must be non-negative");
+	}
+
+	static unique_ptr<brownian_bridge_table> cached;
+	if (precision > 0 && (!cached || cached->precision != precision)) {
+		cached.reset(table.empty() ? nullptr
+								   : brownian_bridge_table::map(table, precision));
+		if (!cached) {
+			cached.reset(new brownian_bridge_table(precision));
+		}
+	}
+
+	NumericVector sf(v.size());
+	for (int i=0; i<v.size(); i++) {
+		if (ISNAN(v[i])) {
+			sf[i] = NA_REAL;
+		} else {
+			sf[i] = (precision > 0) ? cached->sf(v[i])
+									: brownian_bridge_sf_exact(v[i]);
+		}
+	}
+	return sf;
+}
+
+//' brownian_bridge_write_table
+//'
+//' Computes the interpolation table of brownian_bridge_sf for a precision
+//' and writes it to a file that brownian_bridge_sf can memory-map. The
+//' table installed as extdata/brownian_bridge_sf.bin is written by
+//' brownian_bridge_write_table("inst/extdata/brownian_bridge_sf.bin")
+//'
+//' @param path path of the file
+//' @param precision relative error of the interpolated probabilities
+//' @return the number of nodes of the table
+//'
+// [[Rcpp::export]]
+int brownian_bridge_write_table(const std::string path,
+								const double precision=1e-6)
+{
+	if (!(precision > 0)) {
+		stop("brownian_bridge_write_table: Precision must be positive");
+	}
+	brownian_bridge_table table(precision);
+	table.write(path);
+	return table.n;
+}
@@ -0,0 +1,435 @@
+// [[Rcpp::depends(RcppArmadillo)]]
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <RcppArmadillo.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace Rcpp;
+
+
+
+/*=============================================
+
+			CHECKPOINT FILES
+
+==============================================*/
+
+// Genome-wide runs of wasserstein.sc can write the result of every gene to
+// a checkpoint file as soon as its block of genes is tested, so that an
+// interrupted run can be resumed with the genes that are still missing.
+// The file is append-only: a header describing the run, followed by one
+// record per gene with its (1-based) index and its values. A record that
+// was cut short by an interruption is removed when the file is reopened.
+// The multiple testing adjustment and the combination of the p-values of
+// the two-stage test need all genes and are computed in a final pass over
+// the file.
+
+// Layout of checkpoint files, in native byte order: the magic string, the
+// number of genes, the key of the run and the number of values per gene,
+// each followed by the names of the values; then the records, each the
+// gene index as uint64 and the values as doubles. Strings are stored as
+// their length (uint64) and their bytes.
+const char CHECKPOINT_MAGIC[] = "WADDRCK1";
+
+
+//' checkpoint_header
+//'
+//' Header of a checkpoint file: the number of genes, the key of the run
+//' (any string that changes with the settings of the run) and the names of
+//' the values of every gene
+//'
+struct checkpoint_header
+{
+	uint64_t 		ngenes;
+	string 			key;
+	vector<string> 	names;
+
+	// bytes of one record
+	size_t record_size() const
+	{
+		return sizeof(uint64_t) + names.size() * sizeof(double);
+	}
+
+	void write(FILE *file) const
+	{
+		const uint64_t ncol = names.size();
+		bool written = fwrite(CHECKPOINT_MAGIC, 1, 8, file) == 8
+					&& fwrite(&ngenes, sizeof(uint64_t), 1, file) == 1
+					&& write_string(file, key)
+					&& fwrite(&ncol, sizeof(uint64_t), 1, file) == 1;
+		for (const string & name : names) {
+			written = written && write_string(file, name);
+		}
+		if (!written) {
+			stop("checkpoint_header: Cannot write the header");
+		}
+	}
+
+	// reads the header at the start of file; returns false if the file
+	// does not start with a valid header
+	bool read(FILE *file)
+	{
+		char magic[8];
+		uint64_t ncol;
+		if (fread(magic, 1, 8, file) != 8
+			|| memcmp(magic, CHECKPOINT_MAGIC, 8) != 0
+			|| fread(&ngenes, sizeof(uint64_t), 1, file) != 1
+			|| !read_string(file, key)
+			|| fread(&ncol, sizeof(uint64_t), 1, file) != 1
+			|| ncol > (1 << 20)) {
+			return false;
+		}
+		names.resize(ncol);
+		for (string & name : names) {
+			if (!read_string(file, name)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+private:
+	static bool write_string(FILE *file, const string & s)
+	{
+		const uint64_t n = s.size();
+		return fwrite(&n, sizeof(uint64_t), 1, file) == 1
+			   && fwrite(s.data(), 1, n, file) == n;
+	}
+
+	static bool read_string(FILE *file, string & s)
+	{
+		uint64_t n;
+		if (fread(&n, sizeof(uint64_t), 1, file) != 1 || n > (1 << 24)) {
+			return false;
+		}
+		s.resize(n);
+		return n == 0 || fread(&s[0], 1, n, file) == n;
+	}
+};
+
+
+//' checkpoint_read
+//'
+//' Opens a checkpoint file and reads its header. Stops with an error if
+//' the file is not a checkpoint file.
+//'
+//' @param path path of the file
+//' @param header header of the file
+//' @param fn name of the calling function, for error messages
+//' @return the open file, positioned at the first record
+//'
+FILE* checkpoint_read(const string & path, checkpoint_header & header,
+					  const string & fn)
+{
+	FILE *file = fopen(path.c_str(), "rb");
+	if (!file) {
+		stop(fn + ": Cannot open " + path);
+	}
+	if (!header.read(file)) {
+		fclose(file);
+		stop(fn + ": " + path + " is not a checkpoint file");
+	}
+	return file;
+}
+
+
+//' Open a checkpoint file
+//'
+//' Creates the checkpoint file of a run of \code{wasserstein.sc} with the
+//' given header, or reopens an existing one and returns the genes whose
+//' results it already holds. A record at the end of the file that was cut
+//' short by an interruption is removed, so that further records can be
+//' appended.
+//'
+//' @param path path of the checkpoint file
+//' @param ngenes number of genes of the run
+//' @param names names of the values stored for every gene
+//' @param key string identifying the settings of the run; an existing file
+//'  must have been created with the same key, names and number of genes
+//' @return logical vector of length \code{ngenes}, TRUE for the genes whose
+//'  results are in the file
+//'
+// [[Rcpp::export]]
+LogicalVector checkpoint_open(const std::string path,
+							  const int ngenes,
+							  const CharacterVector names,
+							  const std::string key)
+{
+	checkpoint_header expected;
+	expected.ngenes = ngenes;
+	expected.key = key;
+	for (int k=0; k<(int) names.size(); k++) {
+		expected.names.push_back(as<string>(names[k]));
+	}
+	LogicalVector done(ngenes, false);
+
+	FILE *file = fopen(path.c_str(), "rb");
+	if (file && fgetc(file) == EOF) {
+		// an empty file, e.g. a temporary file, is a new checkpoint
+		fclose(file);
+		file = nullptr;
+	}
+	if (!file) {
+		file = fopen(path.c_str(), "wb");
+		if (!file) {
+			stop("checkpoint_open: Cannot create " + path);
+		}
+		expected.write(file);
+		if (fclose(file) != 0) {
+			stop("checkpoint_open: Cannot write " + path);
+		}
+		return done;
+	}
+	fclose(file);
+
+	checkpoint_header header;
+	file = checkpoint_read(path, header, "checkpoint_open");
+	if (header.ngenes != expected.ngenes || header.key != expected.key
+		|| header.names != expected.names) {
+		fclose(file);
+		stop("checkpoint_open: " + path + " belongs to another run");
+	}
+
+	// mark the genes of all complete records
+	const long 		start = ftell(file);
+	vector<double> 	values(header.names.size());
+	long 			end = start;
+	uint64_t 		gene;
+	while (fread(&gene, sizeof(uint64_t), 1, file) == 1
+		   && fread(values.data(), sizeof(double), values.size(), file)
+			  == values.size()) {
+		if (gene < 1 || gene > header.ngenes) {
+			fclose(file);
+			stop("checkpoint_open: " + path + " has an invalid record");
+		}
+		done[gene - 1] = true;
+		end += header.record_size();
+	}
+	fseek(file, 0, SEEK_END);
+	const long size = ftell(file);
+	fclose(file);
+
+	if (size != end) {
+#ifndef _WIN32
+		if (truncate(path.c_str(), end) != 0) {
+			stop("checkpoint_open: Cannot truncate " + path);
+		}
+#else
+		stop("checkpoint_open: " + path + " ends with an incomplete record");
+#endif
+	}
+	return done;
+}
+
+
+//' Append results to a checkpoint file
+//'
+//' Appends one record per gene to a checkpoint file created by
+//' \code{checkpoint_open} and flushes the file, so that the records are
+//' kept if the run is interrupted afterwards.
+//'
+//' @param path path of the checkpoint file
+//' @param genes 1-based indices of the genes
+//' @param values matrix with one row of values per gene, in the order of
+//'  the names of the file
+//' @return the number of records appended
+//'
+// [[Rcpp::export]]
+int checkpoint_append(const std::string path,
+					  const IntegerVector genes,
+					  const NumericMatrix values)
+{
+	checkpoint_header header;
+	fclose(checkpoint_read(path, header, "checkpoint_append"));
+
+	const int 	count = genes.size(),
+				ncol = header.names.size();
+	if (values.nrow() != count || values.ncol() != ncol) {
+		stop("checkpoint_append: values need one row per gene and one column per name");
+	}
+
+	// records are written as whole units of one buffer, so that an
+	// interruption leaves at most one incomplete record at the end
+	vector<char> 	buffer(count * header.record_size());
+	char 			*pos = buffer.data();
+	const double 	*x = values.begin();
+	for (int k=0; k<count; k++) {
+		if (genes[k] < 1 || (uint64_t) genes[k] > header.ngenes) {
+			stop("checkpoint_append: Gene index out of bounds");
+		}
+		const uint64_t gene = genes[k];
+		memcpy(pos, &gene, sizeof(uint64_t));
+		pos += sizeof(uint64_t);
+		for (int c=0; c<ncol; c++) {
+			const double v = x[(size_t) c * count + k];
+			memcpy(pos, &v, sizeof(double));
+			pos += sizeof(double);
+		}
+	}
+
+	FILE *file = fopen(path.c_str(), "ab");
+	if (!file) {
+		stop("checkpoint_append: Cannot open " + path);
+	}
+	bool written = fwrite(buffer.data(), 1, buffer.size(), file)
+				   == buffer.size();
+	written = (fflush(file) == 0) && written;
+#ifndef _WIN32
+	written = (fsync(fileno(file)) == 0) && written;
+#endif
+	written = (fclose(file) == 0) && written;
+	if (!written) {
+		stop("checkpoint_append: Cannot write " + path);
+	}
+	return count;
+}
+
+
+//' bh_adjust
+//'
+//' Adjusted p-values of the method of Benjamini and Hochberg, as
+//' \code{p.adjust(p, method="BH")}: missing p-values stay missing and are
+//' not counted
+//'
+//' @param p p-values
+//' @return adjusted p-values
+//'
+vector<double> bh_adjust(const vector<double> & p)
+{
+	vector<int> order;
+	for (int i=0; i<(int) p.size(); i++) {
+		if (!ISNAN(p[i])) {
+			order.push_back(i);
+		}
+	}
+	// decreasing p-values; ties keep their order, as order() does
+	stable_sort(order.begin(), order.end(),
+				[&](const int a, const int b) { return p[a] > p[b]; });
+
+	const int 		n = order.size();
+	vector<double> 	adjusted(p.size(), NA_REAL);
+	double 			cummin = R_PosInf;
+	for (int k=0; k<n; k++) {
+		const int i = order[k];
+		cummin = min(cummin, (double) n / (n - k) * p[i]);
+		adjusted[i] = min(1.0, cummin);
+	}
+	return adjusted;
+}
+
+
+//' fisher_combine
+//'
+//' Combined p-value of two p-values by Fisher's method, computed as in
+//' \code{.fishersCombinedPval}, so that the results are the same as those
+//' of a run without checkpoint: the upper tail of \eqn{-2(\log r + \log s)}
+//' in the chi-squared distribution with 4 degrees of freedom, or the other
+//' p-value if one of them is missing.
+//'
+//' @param r first p-value
+//' @param s second p-value
+//' @return the combined p-value
+//'
+double fisher_combine(const double r, const double s)
+{
+	if (ISNAN(r) && ISNAN(s)) {
+		return NA_REAL;
+	}
+	if (ISNAN(r) || ISNAN(s)) {
+		return ISNAN(r) ? s : r;
+	}
+	return R::pchisq(-2 * (log(r) + log(s)), 4, 0, 0);
+}
+
+
+//' Collect the results of a checkpoint file
+//'
+//' Final pass over a complete checkpoint file: reads the values of all
+//' genes, in the order of the genes, and computes the adjusted p-values of
+//' the method of Benjamini and Hochberg. If the p-values of the test for
+//' differential proportions of zero expression are given, they are
+//' combined with the p-values of the file by Fisher's method and both are
+//' adjusted as well. If a gene has several records, the last one is used.
+//'
+//' @param path path of the checkpoint file
+//' @param pcol 1-based column of the p-values in the records
+//' @param pzero p-values of the test for differential proportions of zero
+//'  expression of all genes, or NULL
+//' @return a list with the matrix \code{values} of the records of all genes
+//'  and the vector \code{p.adj} of adjusted p-values; if \code{pzero} is
+//'  given, also \code{p.combined}, \code{p.adj.zero} and
+//'  \code{p.adj.combined}
+//'
+// [[Rcpp::export]]
+List checkpoint_collect(const std::string path,
+						const int pcol,
+						Nullable<NumericVector> pzero=R_NilValue)
+{
+	checkpoint_header header;
+	FILE *file = checkpoint_read(path, header, "checkpoint_collect");
+	const int 	ngenes = header.ngenes,
+				ncol = header.names.size();
+	if (pcol < 1 || pcol > ncol) {
+		fclose(file);
+		stop("checkpoint_collect: Column index out of bounds");
+	}
+
+	NumericMatrix 	values(ngenes, ncol);
+	vector<char> 	seen(ngenes, 0);
+	vector<double> 	record(ncol);
+	uint64_t 		gene;
+	while (fread(&gene, sizeof(uint64_t), 1, file) == 1
+		   && fread(record.data(), sizeof(double), ncol, file)
+			  == (size_t) ncol) {
+		if (gene < 1 || gene > header.ngenes) {
+			fclose(file);
+			stop("checkpoint_collect: " + path + " has an invalid record");
+		}
+		for (int c=0; c<ncol; c++) {
+			values(gene - 1, c) = record[c];
+		}
+		seen[gene - 1] = 1;
+	}
+	fclose(file);
+	if (count(seen.begin(), seen.end(), 0) > 0) {
+		stop("checkpoint_collect: " + path + " misses genes");
+	}
+	colnames(values) = CharacterVector(header.names.begin(),
+									   header.names.end());
+
+	vector<double> p(ngenes);
+	for (int g=0; g<ngenes; g++) {
+		p[g] = values(g, pcol - 1);
+	}
+	const vector<double> p_adj = bh_adjust(p);
+	if (pzero.isNull()) {
+		return List::create(
+			Named("values") = values,
+			Named("p.adj") = NumericVector(p_adj.begin(), p_adj.end()));
+	}
+
+	const NumericVector zero(pzero.get());
+	if ((int) zero.size() != ngenes) {
+		stop("checkpoint_collect: pzero needs one p-value per gene");
+	}
+	vector<double> 	p_zero(zero.begin(), zero.end()),
+					combined(ngenes);
+	for (int g=0; g<ngenes; g++) {
+		combined[g] = fisher_combine(p[g], p_zero[g]);
+	}
+	const vector<double> 	adj_zero = bh_adjust(p_zero),
+							adj_combined = bh_adjust(combined);
+	return List::create(
+		Named("values") = values,
+		Named("p.adj") = NumericVector(p_adj.begin(), p_adj.end()),
+		Named("p.combined") = NumericVector(combined.begin(), combined.end()),
+		Named("p.adj.zero") = NumericVector(adj_zero.begin(), adj_zero.end()),
+		Named("p.adj.combined") = NumericVector(adj_combined.begin(),
+												adj_combined.end()));
+}
@@ -0,0 +1,622 @@
+// [[Rcpp::depends(RcppArmadillo)]]
+
+#include <memory>
+#include <RcppArmadillo.h>
+
+using namespace std;
+using namespace Rcpp;
+
+
+
+/*=============================================
+
+		GENERALIZED PARETO DISTRIBUTION
+
+==============================================*/
+
+// The semi-parametric test estimates small p-values from the upper tail of
+// the permutation distribution: a generalized Pareto distribution (GPD) is
+// fitted to the largest values, after checking with an Anderson-Darling test
+// that a GPD fits them. The GPD with location 0, scale sigma and shape xi has
+// P(X > q) = (1 + xi q / sigma)^(-1/xi), or exp(-q / sigma) for xi = 0.
+
+
+//' gpd_sf
+//'
+//' @param q quantile
+//' @param scale scale of the GPD
+//' @param shape shape of the GPD
+//' @return P(X > q) for the GPD with location 0
+//'
+double gpd_sf(const double q, const double scale, const double shape)
+{
+	if (q <= 0) {
+		return 1.0;
+	}
+	if (shape == 0) {
+		return exp(-q / scale);
+	}
+	const double z = 1 + shape * q / scale;
+	return (z <= 0) ? 0.0 : exp(-log(z) / shape);
+}
+
+
+//' gpd_profile
+//'
+//' Profile log-likelihood of the GPD with location 0 in theta = xi / sigma
+//' (Grimshaw, 1993): for fixed theta, the likelihood is maximized by
+//' xi(theta) = mean(log(1 + theta y)) and sigma = xi(theta) / theta, which
+//' leaves a one-dimensional maximization over theta > -1/max(y).
+//'
+struct gpd_profile
+{
+	const double 	*y;
+	int 			n;
+	double 			y_max,
+					mean,			// moments of y, for theta close to 0
+					mean_sq,
+					mean_cube;
+
+	gpd_profile(const double *y, const int n)
+		: y(y), n(n), y_max(0), mean(0), mean_sq(0), mean_cube(0)
+	{
+		for (int i=0; i<n; i++) {
+			y_max = max(y_max, y[i]);
+			mean += y[i];
+			mean_sq += y[i] * y[i];
+			mean_cube += y[i] * y[i] * y[i];
+		}
+		mean /= n;
+		mean_sq /= n;
+		mean_cube /= n;
+	}
+
+	double shape(const double theta) const
+	{
+		double sum = 0.0;
+		for (int i=0; i<n; i++) {
+			sum += log1p(theta * y[i]);
+		}
+		return sum / n;
+	}
+
+	double scale(const double theta, const double shape) const
+	{
+		// xi(theta) / theta cancels for small theta, use its series instead
+		if (abs(theta) * y_max < 1e-6) {
+			return mean - theta * mean_sq / 2 + theta * theta * mean_cube / 3;
+		}
+		return shape / theta;
+	}
+
+	// log-likelihood divided by n
+	double loglik(const double theta) const
+	{
+		const double xi = shape(theta);
+		return -log(scale(theta, xi)) - 1 - xi;
+	}
+};
+
+
+//' gpd_fit_mle
+//'
+//' Maximum likelihood fit of the GPD with location 0. The profile
+//' log-likelihood is maximized by Brent's method in phi = log(theta +
+//' 1/max(y)), which maps the admissible theta to the real line, after a
+//' maximum has been bracketed by expanding steps from the start value.
+//' The likelihood is unbounded for xi < -1, so the maximum is searched
+//' where xi >= -1 only.
+//'
+//' @param y positive values
+//' @param n number of values
+//' @param theta start value of theta, e.g. from the fit of a similar
+//'  sample; NaN to start from the moment estimates. Set to the fitted theta
+//' @param scale set to the fitted scale
+//' @param shape set to the fitted shape
+//'
+void gpd_fit_mle(	const double *y,
+					const int n,
+					double &theta,
+					double &scale,
+					double &shape)
+{
+	if (n < 2) {
+		stop("gpd_fit: At least two values are needed");
+	}
+	const gpd_profile profile(y, n);
+	if (!(profile.y_max > 0)) {
+		stop("gpd_fit: Values must be positive");
+	}
+	const double offset = 1 / profile.y_max;
+
+	// phi is valid if xi(theta(phi)) >= -1
+	auto value = [&](const double phi, bool &valid) {
+		const double t = exp(phi) - offset;
+		valid = profile.shape(t) >= -1;
+		return valid ? profile.loglik(t) : 0.0;
+	};
+
+	// start from the moment estimates, unless a valid start is given
+	bool valid = false;
+	double 	b = 0.0,
+			fb = 0.0;
+	if (theta > -offset) {
+		b = log(theta + offset);
+		fb = value(b, valid);
+	}
+	if (!valid) {
+		const double 	var = profile.mean_sq - profile.mean * profile.mean,
+						ratio = profile.mean * profile.mean / var;
+		theta = (var > 0) ? (1 - ratio) / (profile.mean * (1 + ratio)) : 0.0;
+		b = log(max(theta, -offset / 2) + offset);
+		fb = value(b, valid);
+	}
+
+	// bracket a maximum: a < b < c with f(b) >= f(a), f(c)
+	double 	step = 0.1,
+			c = b + step,
+			fc = value(c, valid);
+	if (fc > fb) {
+		swap(b, c);
+		swap(fb, fc);
+	} else {
+		step = -step;
+	}
+	double a = c, fa = fc;
+	c = b + step;
+	fc = value(c, valid);
+	for (int iter=0; valid && fc > fb; iter++) {
+		if (iter == 200) {
+			stop("gpd_fit: Maximum likelihood estimate not found");
+		}
+		a = b;
+		fa = fb;
+		b = c;
+		fb = fc;
+		step *= 2;
+		c = b + step;
+		fc = value(c, valid);
+	}
+	if (!valid) {
+		stop("gpd_fit: Maximum likelihood estimate does not exist");
+	}
+	if (a > c) {
+		swap(a, c);
+		swap(fa, fc);
+	}
+
+	// Brent's method for the maximum within (a, c)
+	const double golden = 0.3819660112501051;
+	double 	x = b, w = b, v = b,
+			fx = fb, fw = fb, fv = fb,
+			d = 0.0, e = 0.0;
+	for (int iter=0; iter<200; iter++) {
+		const double 	mid = (a + c) / 2,
+						tol = 1e-10 * abs(x) + 1e-12;
+		if (abs(x - mid) <= 2 * tol - (c - a) / 2) {
+			break;
+		}
+		bool parabolic = false;
+		if (abs(e) > tol) {
+			double 	r = (x - w) * (fx - fv),
+					q = (x - v) * (fx - fw),
+					p = (x - v) * q - (x - w) * r;
+			q = 2 * (q - r);
+			if (q > 0) {
+				p = -p;
+			}
+			q = abs(q);
+			if (abs(p) < abs(q * e / 2) && p > q * (a - x) && p < q * (c - x)) {
+				e = d;
+				d = p / q;
+				parabolic = true;
+				if ((x + d) - a < 2 * tol || c - (x + d) < 2 * tol) {
+					d = (x < mid) ? tol : -tol;
+				}
+			}
+		}
+		if (!parabolic) {
+			e = (x < mid) ? c - x : a - x;
+			d = golden * e;
+		}
+		const double u = x + ((abs(d) >= tol) ? d : ((d > 0) ? tol : -tol));
+		const double fu = value(u, valid);
+		if (valid && fu >= fx) {
+			((u < x) ? c : a) = x;
+			v = w; fv = fw;
+			w = x; fw = fx;
+			x = u; fx = fu;
+		} else {
+			((u < x) ? a : c) = u;
+			if (!valid) {
+				continue;
+			}
+			if (fu >= fw || w == x) {
+				v = w; fv = fw;
+				w = u; fw = fu;
+			} else if (fu >= fv || v == x || v == w) {
+				v = u; fv = fu;
+			}
+		}
+	}
+
+	theta = exp(x) - offset;
+	shape = profile.shape(theta);
+	scale = profile.scale(theta, shape);
+}
+
+
+/*=============================================
+
+			ANDERSON-DARLING TEST
+
+==============================================*/
+
+// Under the null hypothesis and with both GPD parameters estimated by
+// maximum likelihood, the Anderson-Darling statistic A^2 converges to
+// sum_j lambda_j Z_j^2 with independent standard normal Z_j, where lambda_j
+// are the eigenvalues of the covariance kernel
+// (min(s,t) - st - g(s)' I^-1 g(t)) / sqrt(s(1-s) t(1-t)), g the gradient
+// of the cdf in the parameters and I the Fisher information (Choulakian and
+// Stephens, 2001). The limit only depends on the shape. For a grid of shapes,
+// the eigenvalues are computed by the Nystrom method and the upper tail of
+// the limit by the inversion formula of Imhof (1961); p-values are
+// interpolated in this table, which is built on first use.
+
+const double AD_SHAPE_MIN = -0.5,
+			 AD_SHAPE_MAX = 1.0,
+			 AD_SHAPE_STEP = 0.05,
+			 AD_STAT_STEP = 0.05;	// grid of A^2 in [0, 6]
+const int 	 AD_NUM_STAT = 121,
+			 AD_QUADRATURE_SIZE = 160,
+			 AD_NUM_EIGENVALUES = 40;
+
+
+//' gauss_legendre
+//'
+//' Nodes and weights of the Gauss-Legendre quadrature on (0, 1)
+//'
+//' @param n number of nodes
+//' @param nodes set to the increasing nodes
+//' @param weights set to the weights
+//'
+void gauss_legendre(const int n, vector<double> &nodes, vector<double> &weights)
+{
+	nodes.assign(n, 0.0);
+	weights.assign(n, 0.0);
+	for (int i=0; i<n; i++) {
+		// Newton's method from the approximate i-th root of P_n
+		double x = cos(M_PI * (i + 0.75) / (n + 0.5)), dp = 1.0;
+		for (int iter=0; iter<100; iter++) {
+			double p0 = 1.0, p1 = x;
+			for (int k=2; k<=n; k++) {
+				const double p2 = ((2 * k - 1) * x * p1 - (k - 1) * p0) / k;
+				p0 = p1;
+				p1 = p2;
+			}
+			dp = n * (x * p1 - p0) / (x * x - 1);
+			const double dx = p1 / dp;
+			x -= dx;
+			if (abs(dx) < 1e-15) {
+				break;
+			}
+		}
+		nodes[i] = (1 - x) / 2;
+		weights[i] = 1 / ((1 - x * x) * dp * dp);
+	}
+}
+
+
+//' ad_tail
+//'
+//' Upper tail of the limit of A^2 for one shape of the GPD
+//'
+//' @param shape shape of the GPD
+//' @return log P(A^2 > stat) on the grid of A^2, and the largest eigenvalue
+//'  as last element, which determines the decay of the tail
+//'
+vector<double> ad_tail(const double shape)
+{
+	vector<double> u, w;
+	gauss_legendre(AD_QUADRATURE_SIZE, u, w);
+	const int n = u.size();
+
+	// gradient of the cdf in (log scale, shape) at the quantile u, and the
+	// inverse of the Fisher information in these parameters
+	vector<double> g_scale(n), g_shape(n);
+	for (int i=0; i<n; i++) {
+		const double 	l = log1p(-u[i]),
+						e = expm1(shape * l);
+		if (abs(shape) < 1e-8) {
+			g_scale[i] = (1 - u[i]) * l;
+			g_shape[i] = -(1 - u[i]) * l * l / 2;
+		} else {
+			g_scale[i] = (1 - u[i]) * e / shape;
+			g_shape[i] = (1 - u[i]) * (shape * l - e) / (shape * shape);
+		}
+	}
+	const double 	i_ss = 2 * (1 + shape),
+					i_sx = -(1 + shape),
+					i_xx = (1 + shape) * (1 + shape);
+
+	arma::mat kernel(n, n);
+	for (int i=0; i<n; i++) {
+		for (int j=0; j<=i; j++) {
+			const double k = min(u[i], u[j]) - u[i] * u[j]
+				- (g_scale[i] * (i_ss * g_scale[j] + i_sx * g_shape[j])
+				   + g_shape[i] * (i_sx * g_scale[j] + i_xx * g_shape[j]));
+			kernel(i, j) = kernel(j, i) = k * sqrt(w[i] * w[j]
+				/ (u[i] * (1 - u[i]) * u[j] * (1 - u[j])));
+		}
+	}
+	const arma::vec eigenvalues = arma::eig_sym(kernel);
+
+	// the largest eigenvalues enter the inversion formula, the others only
+	// with their mean
+	vector<double> lambda;
+	double rest = 0.0;
+	for (int j=n-1; j>=0; j--) {
+		if (eigenvalues(j) <= 0) {
+			break;
+		}
+		if ((int) lambda.size() < AD_NUM_EIGENVALUES) {
+			lambda.push_back(eigenvalues(j));
+		} else {
+			rest += eigenvalues(j);
+		}
+	}
+
+	// Imhof: P(Q > x) = 1/2 + 1/pi int_0^inf sin(a(v) - (x - rest) v / 2)
+	// / (v r(v)) dv, a(v) = sum_j atan(lambda_j v) / 2,
+	// r(v) = prod_j (1 + lambda_j^2 v^2)^(1/4), by Simpson's rule. For the
+	// equally spaced values x, the phases at v differ by a constant
+	// rotation, which is applied to (cos, sin) of the phase instead of
+	// evaluating a sine for every x.
+	const double dv = 0.1;
+	double sum_lambda = 0.0;
+	for (double l : lambda) {
+		sum_lambda += l;
+	}
+	vector<double> integral(AD_NUM_STAT, 0.0);
+	for (int m=0; ; m++) {
+		if (m == 0) {
+			// limit of the integrand at v = 0
+			for (int k=0; k<AD_NUM_STAT; k++) {
+				integral[k] += (sum_lambda - (k * AD_STAT_STEP - rest)) / 2;
+			}
+			continue;
+		}
+		const double v = m * dv;
+		double a = 0.0, log_r = 0.0;
+		for (double l : lambda) {
+			a += atan(l * v) / 2;
+			log_r += log1p(l * l * v * v) / 4;
+		}
+		const double 	amplitude = exp(-log_r) / v;
+		const bool 		last = (m % 2 == 0 && amplitude < 1e-12);
+		const double 	weight = last ? 1 : ((m % 2 == 1) ? 4 : 2);
+		const double 	phase = a + rest * v / 2,
+						step = -AD_STAT_STEP * v / 2,
+						rot_re = cos(step),
+						rot_im = sin(step);
+		double 	z_re = weight * amplitude * cos(phase),
+				z_im = weight * amplitude * sin(phase);
+		for (int k=0; k<AD_NUM_STAT; k++) {
+			integral[k] += z_im;
+			const double re = z_re * rot_re - z_im * rot_im;
+			z_im = z_re * rot_im + z_im * rot_re;
+			z_re = re;
+		}
+		if (last) {
+			break;
+		}
+	}
+
+	vector<double> log_tail(AD_NUM_STAT + 1);
+	for (int k=0; k<AD_NUM_STAT; k++) {
+		const double p = 0.5 + integral[k] * dv / 3 / M_PI;
+		log_tail[k] = log(min(1.0, max(p, 1e-300)));
+	}
+	log_tail[AD_NUM_STAT] = lambda.empty() ? 0.0 : lambda[0];
+	return log_tail;
+}
+
+
+//' ad_null_table
+//'
+//' Table of log P(A^2 > stat) on the grid of shapes and values of A^2
+//'
+struct ad_null_table
+{
+	vector<vector<double>> 	log_tail;		// per shape
+	vector<double> 			largest;		// largest eigenvalue per shape
+
+	ad_null_table()
+	{
+		const int num_shapes = (int) round((AD_SHAPE_MAX - AD_SHAPE_MIN)
+										   / AD_SHAPE_STEP) + 1;
+		for (int s=0; s<num_shapes; s++) {
+			vector<double> tail = ad_tail(AD_SHAPE_MIN + s * AD_SHAPE_STEP);
+			largest.push_back(tail.back());
+			tail.pop_back();
+			log_tail.push_back(tail);
+		}
+	}
+
+	// log P(A^2 > stat) for one shape of the grid; beyond the grid, the
+	// tail decays like exp(-stat / (2 lambda_1))
+	double log_pvalue(const int s, const double stat) const
+	{
+		const double pos = stat / AD_STAT_STEP;
+		if (pos >= AD_NUM_STAT - 1) {
+			return log_tail[s][AD_NUM_STAT - 1]
+				   - (stat - (AD_NUM_STAT - 1) * AD_STAT_STEP) / (2 * largest[s]);
+		}
+		const int k = (int) pos;
+		const double w = pos - k;
+		return (1 - w) * log_tail[s][k] + w * log_tail[s][k + 1];
+	}
+
+	// p-value by linear interpolation in the shape and the statistic
+	double pvalue(const double stat, const double shape) const
+	{
+		if (!(stat > 0)) {
+			return 1.0;
+		}
+		const double pos = (shape - AD_SHAPE_MIN) / AD_SHAPE_STEP;
+		const int s = min((int) pos, (int) log_tail.size() - 2);
+		const double w = pos - s;
+		return exp((1 - w) * log_pvalue(s, stat) + w * log_pvalue(s + 1, stat));
+	}
+};
+
+
+//' ad_pvalue
+//'
+//' @param stat Anderson-Darling statistic
+//' @param shape estimated shape of the GPD, within [-0.5, 1]
+//' @return p-value of the Anderson-Darling test
+//'
+double ad_pvalue(const double stat, const double shape)
+{
+	static unique_ptr<ad_null_table> table;
+	if (!table) {
+		table.reset(new ad_null_table());
+	}
+	return table->pvalue(stat, shape);
+}
+
+
+//' gpd_ad
+//'
+//' Anderson-Darling test whether values follow a GPD with location 0, with
+//' the parameters fitted by maximum likelihood
+//'
+//' @param x values in decreasing order
+//' @param n number of values
+//' @param theta start value of the fit, see gpd_fit_mle; set to the fitted
+//'  theta
+//' @param out set to the statistic, the p-value, the scale and the shape
+//'
+void gpd_ad(const double *x, const int n, double &theta, double out[4])
+{
+	double scale, shape;
+	gpd_fit_mle(x, n, theta, scale, shape);
+	if (shape < AD_SHAPE_MIN || shape > AD_SHAPE_MAX) {
+		stop("gpd_ad: Estimated shape is outside of [-0.5, 1]");
+	}
+
+	// as x is decreasing, the fitted cdf at x[n-1-i] is increasing in i
+	double sum = 0.0;
+	for (int i=0; i<n; i++) {
+		const double 	lower = gpd_sf(x[n - 1 - i], scale, shape),
+						upper = gpd_sf(x[i], scale, shape);
+		sum += (2.0 * i + 1) * (log1p(-lower) + log(upper));
+	}
+	const double stat = -n - sum / n;
+
+	out[0] = stat;
+	out[1] = ad_pvalue(stat, shape);
+	out[2] = scale;
+	out[3] = shape;
+}
+
+
+//' Fit of a generalized Pareto distribution
+//'
+//' Fits a generalized Pareto distribution (GPD) with location 0 to
+//' positive values by maximum likelihood
+//'
+//' @param y vector of positive values
+//' @return a vector with the fitted scale and shape
+//'
+//' @references Grimshaw, S. D. (1993). Computing maximum likelihood estimates for the generalized Pareto distribution. Technometrics, 35, 185-191.
+//'
+// [[Rcpp::export]]
+NumericVector gpd_fit(const NumericVector y)
+{
+	double theta = NAN, scale, shape;
+	gpd_fit_mle(y.begin(), y.size(), theta, scale, shape);
+	NumericVector fit = NumericVector::create(scale, shape);
+	fit.names() = CharacterVector::create("scale", "shape");
+	return fit;
+}
+
+
+//' Anderson-Darling test for a generalized Pareto distribution
+//'
+//' Tests whether values follow a generalized Pareto distribution (GPD) with
+//' location 0, whose scale and shape are fitted by maximum likelihood. The
+//' p-value is interpolated in a table of the asymptotic distribution of the
+//' statistic, which depends on the shape only and is tabulated for shapes
+//' within [-0.5, 1].
+//'
+//' @param x vector of positive values
+//' @return a vector with the statistic, the p-value and the fitted scale
+//'  and shape
+//'
+//' @references Choulakian, V. and Stephens, M. A. (2001). Goodness-of-fit tests for the generalized Pareto distribution. Technometrics, 43, 478-484.
+//'
+//' Imhof, J. P. (1961). Computing the distribution of quadratic forms in normal variables. Biometrika, 48, 419-426.
+//'
+// [[Rcpp::export]]
+NumericVector gpd_ad_test(const NumericVector x)
+{
+	vector<double> sorted(x.begin(), x.end());
+	sort(sorted.begin(), sorted.end(), greater<double>());
+	double theta = NAN, out[4];
+	gpd_ad(sorted.data(), sorted.size(), theta, out);
+	NumericVector res = NumericVector::create(out[0], out[1], out[2], out[3]);
+	res.names() = CharacterVector::create("statistic", "p.value", "scale",
+										  "shape");
+	return res;
+}
+
+
+//' gpd_fitted_pvalue
+//'
+//' P-value from the GPD fitted to the upper tail of a permutation
+//' distribution, see .gpdFittedPValue. The number of exceedances is
+//' decreased from 250 in steps of 10 until an Anderson-Darling test accepts
+//' a GPD for the exceedances over the threshold between the largest values
+//' and the rest; each fit starts from the previous one.
+//'
+//' @param val value of the test statistic
+//' @param distr_ordered upper tail of the permutation distribution, in
+//'  decreasing order, with at least 251 values
+//' @param bsn total number of permutations
+//' @return a vector with the p-value, the p-value of the Anderson-Darling
+//'  test and the number of exceedances
+//'
+// [[Rcpp::export]]
+NumericVector gpd_fitted_pvalue(const double val,
+								const NumericVector distr_ordered,
+								const double bsn)
+{
+	if (distr_ordered.size() < 251) {
+		stop("gpd_fitted_pvalue: At least 251 values are needed");
+	}
+	const double *x = distr_ordered.begin();
+	vector<double> excess;
+	double theta = NAN, threshold = 0.0, ad[4];
+	int n_exc = 250;
+	for (;; n_exc -= 10) {
+		if (n_exc < 10) {
+			stop("gpd_fitted_pvalue: No number of exceedances gives a GPD fit");
+		}
+		threshold = (x[n_exc - 1] + x[n_exc]) / 2;
+		excess.clear();
+		for (int i=0; i<n_exc; i++) {
+			excess.push_back(x[i] - threshold);
+		}
+		gpd_ad(excess.data(), n_exc, theta, ad);
+		if (ad[1] > 0.05) {
+			break;
+		}
+	}
+
+	NumericVector res = NumericVector::create(
+		(n_exc / bsn) * gpd_sf(val - threshold, ad[2], ad[3]), ad[1], n_exc);
+	res.names() = CharacterVector::create("pvalue.gpd", "ad.pval", "N.exc");
+	return res;
+}
@@ -0,0 +1,68 @@
+// [[Rcpp::depends(RcppArmadillo)]]
+
+#include <chrono>
+#include <RcppArmadillo.h>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+using namespace std;
+using namespace Rcpp;
+
+
+
+/*=============================================
+
+			PROFILING
+
+==============================================*/
+
+// Opt-in profiling of wasserstein.sc records the time of the stages of the
+// test of every gene and the memory of the process that tests it. Both are
+// read natively, so that a measurement costs well below a microsecond and
+// does not allocate on the R heap, unlike proc.time() or gc().
+
+
+//' Monotonic clock for profiling
+//'
+//' Reads a monotonic clock, which is not affected by changes of the system
+//' time, so that differences of two readings are elapsed wall times.
+//'
+//' @return seconds since an arbitrary, fixed point in time
+//'
+// [[Rcpp::export]]
+double profile_clock()
+{
+	const auto now = chrono::steady_clock::now().time_since_epoch();
+	return chrono::duration<double>(now).count();
+}
+
+
+//' Peak resident memory of the process
+//'
+//' Reads the largest resident set size the calling process has had so far
+//' from getrusage(). In a BiocParallel worker, this is the peak memory of
+//' the worker.
+//'
+//' @return peak resident set size in bytes, NA on Windows
+//'
+// [[Rcpp::export]]
+double profile_peak_rss()
+{
+#ifdef _WIN32
+	return NA_REAL;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) {
+		return NA_REAL;
+	}
+#ifdef __APPLE__
+	// bytes on macOS
+	return (double) usage.ru_maxrss;
+#else
+	// kilobytes on Linux
+	return 1024.0 * usage.ru_maxrss;
+#endif
+#endif
+}
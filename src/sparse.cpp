@@ -0,0 +1,184 @@
+// [[Rcpp::depends(RcppArmadillo)]]
+
+#include <RcppArmadillo.h>
+
+using namespace std;
+using namespace Rcpp;
+
+
+
+/*=============================================
+
+			SPARSE EXPRESSION MATRICES
+
+==============================================*/
+
+// Expression matrices of single-cell experiments are stored as dgCMatrix,
+// i.e. in compressed sparse column (CSC) layout with genes in rows. The
+// tests work gene by gene, so the matrix is transposed once into a
+// compressed sparse row (CSR) layout, in which the non-zero entries of a
+// gene are contiguous. Both layouts need memory proportional to the number
+// of non-zero entries only.
+
+//' sparse_csr
+//'
+//' Transposes a dgCMatrix from compressed sparse column into compressed
+//' sparse row layout
+//'
+//' @param m dgCMatrix with genes in rows and cells in columns
+//' @return a list with the row pointers p (length nrow + 1), the 0-based
+//'  column indices j and the values x of the non-zero entries, ordered by
+//'  row and column, and the dimension Dim of m
+//'
+// [[Rcpp::export]]
+List sparse_csr(const S4 m)
+{
+	const IntegerVector 	dim = m.slot("Dim"),
+							col_p = m.slot("p"),
+							row_i = m.slot("i");
+	const NumericVector 	val = m.slot("x");
+	const int 				nrow = dim[0],
+							ncol = dim[1];
+
+	// count the entries per row, then turn the counts into row pointers
+	IntegerVector row_p(nrow + 1, 0);
+	for (int k=0; k<col_p[ncol]; k++) {
+		++row_p[row_i[k] + 1];
+	}
+	for (int r=0; r<nrow; r++) {
+		row_p[r + 1] += row_p[r];
+	}
+
+	// scatter the entries column by column, so that the column indices
+	// within each row are increasing
+	IntegerVector 	col_j(col_p[ncol]);
+	NumericVector 	row_x(col_p[ncol]);
+	vector<int> 	next(row_p.begin(), row_p.end() - 1);
+	for (int c=0; c<ncol; c++) {
+		for (int k=col_p[c]; k<col_p[c + 1]; k++) {
+			int pos = next[row_i[k]]++;
+			col_j[pos] = c;
+			row_x[pos] = val[k];
+		}
+	}
+
+	return List::create(
+		Named("p") = row_p,
+		Named("j") = col_j,
+		Named("x") = row_x,
+		Named("Dim") = dim);
+}
+
+//' sparse_row
+//'
+//' Expands one row of a matrix in compressed sparse row layout
+//'
+//' @param csr a list as returned by sparse_csr
+//' @param row 1-based index of the row
+//' @return the row as a dense vector of length ncol
+//'
+// [[Rcpp::export]]
+NumericVector sparse_row(const List csr, const int row)
+{
+	const IntegerVector 	dim = csr["Dim"],
+							row_p = csr["p"],
+							col_j = csr["j"];
+	const NumericVector 	row_x = csr["x"];
+
+	if (row < 1 || row > dim[0]) {
+		stop("sparse_row: Row index out of bounds");
+	}
+	NumericVector dense(dim[1], 0.0);
+	for (int k=row_p[row - 1]; k<row_p[row]; k++) {
+		dense[col_j[k]] = row_x[k];
+	}
+	return dense;
+}
+
+//' sparse_row_split
+//'
+//' Splits one row of a matrix in compressed sparse row layout into the
+//' samples of two conditions
+//'
+//' @param csr a list as returned by sparse_csr
+//' @param row 1-based index of the row
+//' @param group vector of length ncol with the condition (1 or 2) of each
+//'  column
+//' @param inclZero logical; if TRUE, the samples contain all values of the
+//'  row, including zeroes; if FALSE, they contain the non-zero values only
+//'  and are built from the non-zero entries without expanding the row
+//' @return a list with the samples x1 and x2 of both conditions, each in
+//'  column order
+//'
+// [[Rcpp::export]]
+List sparse_row_split(	const List csr,
+						const int row,
+						const IntegerVector group,
+						const bool inclZero=true)
+{
+	const IntegerVector 	dim = csr["Dim"],
+							row_p = csr["p"],
+							col_j = csr["j"];
+	const NumericVector 	row_x = csr["x"];
+
+	if (row < 1 || row > dim[0]) {
+		stop("sparse_row_split: Row index out of bounds");
+	}
+	if (group.size() != dim[1]) {
+		stop("sparse_row_split: Length of group must equal the number of columns");
+	}
+
+	vector<double> x1, x2;
+	if (inclZero) {
+		// position of every column within its condition
+		vector<int> pos(dim[1]);
+		int n1 = 0, n2 = 0;
+		for (int c=0; c<dim[1]; c++) {
+			pos[c] = (group[c] == 1) ? n1++ : n2++;
+		}
+		x1.assign(n1, 0.0);
+		x2.assign(n2, 0.0);
+		for (int k=row_p[row - 1]; k<row_p[row]; k++) {
+			int c = col_j[k];
+			((group[c] == 1) ? x1 : x2)[pos[c]] = row_x[k];
+		}
+	} else {
+		for (int k=row_p[row - 1]; k<row_p[row]; k++) {
+			if (row_x[k] > 0) {
+				((group[col_j[k]] == 1) ? x1 : x2).push_back(row_x[k]);
+			}
+		}
+	}
+
+	return List::create(
+		Named("x1") = NumericVector(x1.begin(), x1.end()),
+		Named("x2") = NumericVector(x2.begin(), x2.end()));
+}
+
+//' sparse_detection
+//'
+//' Cellular detection rate of a dgCMatrix, i.e. the fraction of genes with
+//' positive expression in each cell
+//'
+//' @param m dgCMatrix with genes in rows and cells in columns
+//' @return vector of length ncol, equal to colSums(m > 0) / nrow(m)
+//'
+// [[Rcpp::export]]
+NumericVector sparse_detection(const S4 m)
+{
+	const IntegerVector 	dim = m.slot("Dim"),
+							col_p = m.slot("p");
+	const NumericVector 	val = m.slot("x");
+
+	NumericVector detection(dim[1], 0.0);
+	for (int c=0; c<dim[1]; c++) {
+		int positive = 0;
+		for (int k=col_p[c]; k<col_p[c + 1]; k++) {
+			if (val[k] > 0) {
+				++positive;
+			}
+		}
+		detection[c] = (double) positive / dim[0];
+	}
+	return detection;
+}
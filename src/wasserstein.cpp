@@ -1,6 +1,14 @@
 // [[Rcpp::depends(RcppArmadillo)]]
 
 #include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <queue>
+#include <system_error>
+#include <thread>
 #include <iostream>
 #include <math.h>
 #include <RcppArmadillo.h>
@@ -20,157 +28,262 @@ using namespace Rcpp;
 
 ==============================================*/ 
 
-//' vector_factor_addition
+// Element-wise operations on vectors don't return new vectors but
+// lightweight expression objects that refer to their operands. An
+// expression is evaluated element by element in a single loop when it is
+// assigned to a vector or reduced with sum or mean, so that e.g.
+// sum((uu1 - uu0) * pow(abs(b - a), p)) allocates no intermediate vectors.
+// Operands are referenced, so an expression must be evaluated within the
+// statement that builds it.
+
+//' vector_expression
 //'
-//' @param x vector 
-//' @param summand numerical
-//' @return a vector containing the sum of each element in x and the summand
+//' Base class of all vector expressions (curiously recurring template
+//' pattern): E provides value_type, size() and the element access
+//' operator[]
+//'
+template <typename E>
+struct vec_expr
+{
+	const E & self() const { return static_cast<const E &>(*this); }
+
+	// evaluates the expression in a single loop
+	template <typename T>
+	operator vector<T>() const
+	{
+		const E & e = self();
+		vector<T> result(e.size());
+		for (size_t i=0; i<result.size(); i++) {
+			result[i] = e[i];
+		}
+		return result;
+	}
+};
+
+//' vector_expression_leaf
 //'
+//' @param v vector that is referenced by an expression
+//'
+template <typename T>
+struct vec_leaf : vec_expr<vec_leaf<T> >
+{
+	typedef T value_type;
+	const vector<T> & v;
+
+	vec_leaf(const vector<T> & v) : v(v) {}
+	size_t size() const { return v.size(); }
+	T operator[](const size_t i) const { return v[i]; }
+};
+
+// is_vec<X>::value is true for vectors and vector expressions,
+// expr_of<X>::type is the expression type that represents X
+template <typename X>
+struct is_vec : integral_constant<bool, is_base_of<vec_expr<X>, X>::value> {};
+template <typename T>
+struct is_vec<vector<T> > : true_type {};
+
+template <typename X>
+struct expr_of { typedef X type; };
 template <typename T>
-vector<T> operator+(vector<T> x, T summand)
+struct expr_of<vector<T> > { typedef vec_leaf<T> type; };
+
+// element-wise operations
+struct vec_add { template <typename T> static T apply(const T & x, const T & y) { return x + y; } };
+struct vec_sub { template <typename T> static T apply(const T & x, const T & y) { return x - y; } };
+struct vec_mul { template <typename T> static T apply(const T & x, const T & y) { return x * y; } };
+struct vec_div { template <typename T> static T apply(const T & x, const T & y) { return x / y; } };
+
+//' vector_vector_expression
+//'
+//' Element-wise operation on two vector expressions of equal size. If the
+//' sizes differ, addition and subtraction stop with an error, whereas
+//' multiplication and division warn and fall back to the first element of
+//' y as a factor (divisor).
+//'
+//' @param x vector expression
+//' @param y vector expression
+//' @param name name of the operation used in messages
+//'
+template <typename Op, typename L, typename R>
+struct vec_binary : vec_expr<vec_binary<Op, L, R> >
 {
-	vector<T> result(x.begin(), x.end());
+	typedef typename L::value_type value_type;
+	const L x;
+	const R y;
+	bool by_first;
+
+	vec_binary(const L & x, const R & y, const char * name)
+		: x(x), y(y), by_first(false)
+	{
+		if (x.size() == y.size()) {
+			return;
+		}
+		if (is_same<Op, vec_add>::value || is_same<Op, vec_sub>::value) {
+			stop(string(name) + ": Sizes of vectors x and y are incompatible.");
+		}
+		std::stringstream ss;
+		ss 	<< name << ": Sizes of vectors x and y are incompatible. "
+			<< (is_same<Op, vec_mul>::value
+				? "Attempting multiplication by factor with y[0]"
+				: "Attempting division of x by y[0] ...");
+		warning(ss.str());
+		if (y.size() < 1) {
+			stop("Invalid vector y");
+		}
+		by_first = true;
+	}
 
-	for (T & element : result) {
-		element = element + summand;
+	size_t size() const { return x.size(); }
+	value_type operator[](const size_t i) const
+	{
+		return Op::apply(x[i], (value_type) y[by_first ? 0 : i]);
 	}
-	return result;
+};
+
+//' vector_scalar_expression
+//'
+//' Element-wise operation on a vector expression and a number
+//'
+//' @param x vector expression
+//' @param s numerical
+//'
+template <typename Op, typename L>
+struct vec_scalar : vec_expr<vec_scalar<Op, L> >
+{
+	typedef typename L::value_type value_type;
+	const L x;
+	const value_type s;
+
+	vec_scalar(const L & x, const value_type s) : x(x), s(s) {}
+	size_t size() const { return x.size(); }
+	value_type operator[](const size_t i) const { return Op::apply(x[i], s); }
+};
+
+//' vector_absolute_expression
+//'
+//' @param x vector expression
+//'
+template <typename L>
+struct vec_abs : vec_expr<vec_abs<L> >
+{
+	typedef typename L::value_type value_type;
+	const L x;
+
+	vec_abs(const L & x) : x(x) {}
+	size_t size() const { return x.size(); }
+	value_type operator[](const size_t i) const { return abs(x[i]); }
+};
+
+//' vector_pow_expression
+//'
+//' @param x vector expression
+//' @param exp numerical representing the exponent
+//'
+template <typename L>
+struct vec_pow : vec_expr<vec_pow<L> >
+{
+	typedef typename L::value_type value_type;
+	const L x;
+	const value_type exp;
+
+	vec_pow(const L & x, const value_type exp) : x(x), exp(exp) {}
+	size_t size() const { return x.size(); }
+	value_type operator[](const size_t i) const { return pow(x[i], exp); }
+};
+
+// result types of the operators, only defined for vector operands
+template <typename Op, typename X, typename Y>
+struct vec_binary_of
+	: enable_if<is_vec<X>::value && is_vec<Y>::value,
+				vec_binary<Op, typename expr_of<X>::type,
+						   typename expr_of<Y>::type> > {};
+template <typename Op, typename X, typename S>
+struct vec_scalar_of
+	: enable_if<is_vec<X>::value && is_arithmetic<S>::value,
+				vec_scalar<Op, typename expr_of<X>::type> > {};
+
+//' vector_factor_addition
+//'
+//' @param x vector 
+//' @param summand numerical
+//' @return an expression for the sum of each element in x and the summand
+//'
+template <typename X, typename S>
+typename vec_scalar_of<vec_add, X, S>::type operator+(const X & x, const S & summand)
+{
+	return typename vec_scalar_of<vec_add, X, S>::type(x, summand);
 }
 
 //' vector_vector_addition
 //'
 //' @param x vector 
 //' @param y vector
-//' @return a vector containing at each position i the sum of x[i] + y[i]
+//' @return an expression for the sum x[i] + y[i] at each position i
 //'
-template <typename T>
-vector<T> operator+(vector<T> x, vector<T> y)
+template <typename X, typename Y>
+typename vec_binary_of<vec_add, X, Y>::type operator+(const X & x, const Y & y)
 {
-	if (x.size() != y.size()) {
-		stop("add: Sizes of vectors x and y are incompatible.");
-	} else {
-		vector<T> result(x.begin(), x.end());
-		for (int i=0; i<x.size(); i++) {
-			result[i] = x[i] + y[i];
-		}
-		return result;
-	}
+	return typename vec_binary_of<vec_add, X, Y>::type(x, y, "add");
 }
 
 //' vector_factor_multiplication
 //'
 //' @param x vector 
 //' @param factor numerical
-//' @return a vector containing the product of each element in x and the factor
+//' @return an expression for the product of each element in x and the factor
 //'
-template <typename T>
-vector<T> operator*(const vector<T> & x, const T & factor)
-{ 
-  vector<T> result(x.begin(), x.end());
-  
-  for (T & element : result) {
-    element = element * factor;
-  }
-
-  return result;
+template <typename X, typename S>
+typename vec_scalar_of<vec_mul, X, S>::type operator*(const X & x, const S & factor)
+{
+	return typename vec_scalar_of<vec_mul, X, S>::type(x, factor);
 }
 
 //' vector_vector_multiplication
 //'
 //' @param x vector 
 //' @param y vector
-//' @return a vector containing at each position i the product  x[i] * y[i]
+//' @return an expression for the product x[i] * y[i] at each position i
 //'
-template <typename T>
-vector<T> operator*(const vector<T> & x, const vector<T> & y)
-{ 
-  vector<T> result(x.begin(), x.end());
-  if (x.size() != y.size()) {
-  	std::stringstream ss;
-  	ss 	<< "multiply: Sizes of vectors x and y are incompatible. "
-  		<< "Attempting multiplication by factor with y[0]";
-  	warning(ss.str());
-
-  	if (y.size() >=1) {
-  		const double factor = y[0];
-  		result = x * factor;
-  	} else {
-  		stop("Invalid vector y");
-  	}
-  } else {
-    for (int i=0; i<x.size(); i++) {
-      result[i] = x[i] * y[i];
-    }
-  }
-  return result;
+template <typename X, typename Y>
+typename vec_binary_of<vec_mul, X, Y>::type operator*(const X & x, const Y & y)
+{
+	return typename vec_binary_of<vec_mul, X, Y>::type(x, y, "multiply");
 }
 
 //' vector_vector_subtract
 //'
 //' @param x vector 
 //' @param y vector
-//' @return vector representing the subtraction x - y
+//' @return an expression for the subtraction x - y
 //'
-template <typename T>
-vector<T> operator-(const vector<T> & x, const vector<T> & y)
-{
-  if (x.size() != y.size()) {
-  	stop("subtract: Sizes of vectors x and y are incompatible.");
-  } else {
-  	vector<T> result(x.begin(), x.end());
-    for (int i=0; i<x.size(); i++) {
-      result[i] = x[i] - y[i];
-    }
-    return result;
-  }
+template <typename X, typename Y>
+typename vec_binary_of<vec_sub, X, Y>::type operator-(const X & x, const Y & y)
+{
+	return typename vec_binary_of<vec_sub, X, Y>::type(x, y, "subtract");
 }
 
 //' vector_factor_division
 //'
 //' @param x vector 
 //' @param divisor numerical
-//' @return a vector containing the result of each 
-//'   element in x divided by divisor
+//' @return an expression for each element in x divided by divisor
 //'
-template <typename T>
-vector<T> operator/(const vector<T> & x, const T & divisor)
+template <typename X, typename S>
+typename vec_scalar_of<vec_div, X, S>::type operator/(const X & x, const S & divisor)
 {
-  vector<T> result(x.begin(), x.end());
-  for (T& element : result) {
-    element = element / divisor;
-  }
-  return result;
+	return typename vec_scalar_of<vec_div, X, S>::type(x, divisor);
 }
 
 //' vector_vector_division
 //'
 //' @param x vector 
 //' @param y vector
-//' @return a vector containing the product of each element
-//'   in x and the factor
+//' @return an expression for the quotient x[i] / y[i] at each position i
 //'
-template <typename T>
-vector<T> operator/(const vector<T> & x, const vector<T> & y)
-{ 
-  vector<T> result(x.begin(), x.end());
-  if (x.size() != y.size()) {
-  	std::stringstream ss;
-  	ss 	<< "divide: Sizes of vectors x and y are incompatible. "
-  		<< "Attempting division of x by y[0] ...";
-  	warning(ss.str());
-
-  	if (y.size() >=1) {
-  		const double divisor = y[0];
-  		result = x / divisor;
-  	} else {
-  		stop("Invalid vector y");
-  	}
-  } else {
-    for (int i=0; i<x.size(); i++) {
-      result[i] = x[i] / y[i];
-    }
-  }
-  return result;
+template <typename X, typename Y>
+typename vec_binary_of<vec_div, X, Y>::type operator/(const X & x, const Y & y)
+{
+	return typename vec_binary_of<vec_div, X, Y>::type(x, y, "divide");
 }
 
 
@@ -178,22 +291,31 @@ vector<T> operator/(const vector<T> & x, const vector<T> & y)
 //'
 //' @param x vector 
 //' @param exp numerical representing the exponent
-//' @return a vector containing a copy of x with each 
-//'   element raised to the power of exp
+//' @return an expression for each element of x raised to the power of exp
 //'
-template <typename T>
-vector<T> pow(const vector<T> & x, const T & exp)
+template <typename X, typename S>
+typename enable_if<is_vec<X>::value && is_arithmetic<S>::value,
+				   vec_pow<typename expr_of<X>::type> >::type
+pow(const X & x, const S & exp)
 {
-  vector<T> result(x.begin(), x.end());
-  for (T& element : result) {
-    element = pow(element, exp);
-  }
-  return result;
+	return vec_pow<typename expr_of<X>::type>(x, exp);
+}
+
+//' vector_absolute
+//'
+//' @param x vector with numericals
+//' @return an expression for the absolute values of all elements in x
+//'
+template <typename X>
+typename enable_if<is_vec<X>::value, vec_abs<typename expr_of<X>::type> >::type
+abs(const X & x)
+{
+	return vec_abs<typename expr_of<X>::type>(x);
 }
 
 //' vector_sum
 //'
-//' @param x vector with numerical elements 
+//' @param x vector or vector expression with numerical elements 
 //' @return The sum of all elements in x
 //'
 template <typename T>
@@ -206,10 +328,21 @@ T sum(const vector<T> & x)
   return result;
 }
 
+template <typename E>
+typename E::value_type sum(const vec_expr<E> & x)
+{
+	const E & e = x.self();
+	typename E::value_type result = 0;
+	for (size_t i=0; i<e.size(); i++) {
+		result += e[i];
+	}
+	return result;
+}
+
 
 //' vector_mean
 //'
-//' @param x vector with numericals
+//' @param x vector or vector expression with numericals
 //' @return the average of all elements in x
 //'
 template <typename T>
@@ -228,6 +361,12 @@ double mean(const vector<T> & x)
 	return result;
 }
 
+template <typename E>
+double mean(const vec_expr<E> & x)
+{
+	return (double) sum(x) / x.self().size();
+}
+
 
 //' vector_standard_deviation
 //'
@@ -252,26 +391,6 @@ double sd(const vector<T> & x)
 	}
 }
 
-//' vector_absolute
-//'
-//' @param x vector with numericals
-//' @return vector with the absolute values of all elements in x
-//'
-template <typename T>
-vector<T> abs(const vector<T> & x) 
-{	
-
-	vector<T> out(x.begin(), x.end());
-	for (double& element : out)
-	{	
-		element = abs(element);
-	}
-	
-	return out;
-
-}
-
-
 //' max
 //'
 //' @param x unsorted vector with numerals
@@ -457,6 +576,82 @@ double cor(const vector<T> & x, const vector<T> & y,
 }
 
 
+//' moment_accumulator
+//'
+//' Mean and sum of squared deviations of a stream of values, accumulated in
+//' a single pass (Welford's algorithm)
+//'
+struct moment_accumulator
+{
+	size_t 	n = 0;
+	double 	mean = 0.0,
+			m2 = 0.0;
+
+	void add(const double x)
+	{
+		++n;
+		const double delta = x - mean;
+		mean += delta / n;
+		m2 += delta * (x - mean);
+	}
+
+	// adds the values accumulated by other (Chan et al., 1979)
+	void merge(const moment_accumulator & other)
+	{
+		if (other.n == 0) {
+			return;
+		}
+		const size_t 	total = n + other.n;
+		const double 	delta = other.mean - mean;
+		mean += delta * other.n / total;
+		m2 += other.m2 + delta * delta * ((double) n * other.n / total);
+		n = total;
+	}
+
+	// empirical standard deviation; 0 for less than two values, as in sd
+	double sd() const
+	{
+		return (n > 1) ? sqrt(m2 / (n - 1)) : 0.0;
+	}
+};
+
+
+//' comoment_accumulator
+//'
+//' Means, sums of squared deviations and the sum of cross deviations of two
+//' streams of paired values, accumulated in a single pass
+//'
+struct comoment_accumulator
+{
+	size_t 	n = 0;
+	double 	mean_x = 0.0, mean_y = 0.0,
+			m2_x = 0.0, m2_y = 0.0,
+			c_xy = 0.0;
+
+	void add(const double x, const double y)
+	{
+		++n;
+		const double delta_x = x - mean_x;
+		mean_x += delta_x / n;
+		const double delta_y = y - mean_y;
+		mean_y += delta_y / n;
+		m2_x += delta_x * (x - mean_x);
+		m2_y += delta_y * (y - mean_y);
+		c_xy += delta_x * (y - mean_y);
+	}
+
+	// Pearson correlation with the conventions of cor: 1 for a single pair
+	// or if both streams are constant
+	double cor() const
+	{
+		if (n == 1 || (m2_x == 0 && m2_y == 0)) {
+			return (double) 1;
+		}
+		return c_xy / (sqrt(m2_x) * sqrt(m2_y));
+	}
+};
+
+
 //' vector_cumulative_sum
 //' 
 //' The cumulative sum x[i] is the sum of all previous elements in x:
@@ -488,16 +683,13 @@ vector<T> cumSum(const std::vector<T> & x, const int last_index=0)
 
 
 template <typename T>
-vector<T> quantile(const vector<T> & x, const vector<double> probs, const int type=1)
+vector<T> sorted_quantile(const vector<T> & x_sorted, const vector<double> probs, const int type=1)
 {	
-	int 		n = x.size(),
+	int 		n = x_sorted.size(),
 				np = probs.size();
 
-	vector<T>   x_sorted(x.begin(), x.end()),
-				qs(probs.size());
+	vector<T>   qs(probs.size());
 
-	std::sort(x_sorted.begin(), x_sorted.end());
-	
 	T max_x = x_sorted[n-1];
 
 	// ---------- TYPE 1 QUANTILES -----------
@@ -526,15 +718,96 @@ vector<T> quantile(const vector<T> & x, const vector<double> probs, const int ty
 }
 
 
+//' multiselect
+//'
+//' Partially sorts x such that the elements at the given increasing,
+//' distinct positions are those of the sorted x: the median position is
+//' placed by nth_element, which splits x and the positions into a lower and
+//' an upper half that are handled recursively. Selecting K positions takes
+//' O(n log K) instead of the O(n log n) of a full sort.
+//'
+//' @param first begin of the range of x
+//' @param last end of the range of x
+//' @param pos_first begin of the positions, relative to offset
+//' @param pos_last end of the positions
+//' @param offset position of first in x
+//'
+template <typename Iterator>
+void multiselect(Iterator first, Iterator last,
+				 const size_t * pos_first, const size_t * pos_last,
+				 size_t offset=0)
+{
+	while (pos_first != pos_last) {
+		const size_t * 	pos_mid = pos_first + (pos_last - pos_first) / 2;
+		const Iterator 	nth = first + (*pos_mid - offset);
+		nth_element(first, nth, last);
+		multiselect(first, nth, pos_first, pos_mid, offset);
+
+		// continue with the upper half without recursion
+		offset += nth + 1 - first;
+		first = nth + 1;
+		pos_first = pos_mid + 1;
+	}
+}
+
+
+//' selected_quantile
+//'
+//' Type-1 quantiles of x, as sorted_quantile returns them for the sorted x,
+//' found by selecting the order statistics they refer to (multiselect)
+//' instead of sorting x.
+//'
+//' @param x sample, reordered in place
+//' @param probs levels of the quantiles
+//' @return the quantiles of x at the levels probs
+//'
+template <typename T>
+vector<T> selected_quantile(vector<T> & x, const vector<double> & probs)
+{
+	const size_t 	n = x.size();
+	vector<size_t> 	index(probs.size());
+
+	// type 1: the ceil(n * p)-th smallest value, the smallest for p = 0
+	for (size_t i=0; i<probs.size(); i++) {
+		const double 	nppm = probs[i] * (double) n,
+						j = floor(nppm);
+		index[i] = (nppm > j) ? (size_t) j : (size_t) max(j - 1, 0.0);
+	}
+
+	vector<size_t> positions(index);
+	sort(positions.begin(), positions.end());
+	positions.erase(unique(positions.begin(), positions.end()),
+					positions.end());
+	multiselect(x.begin(), x.end(), positions.data(),
+				positions.data() + positions.size());
+
+	vector<T> qs(probs.size());
+	for (size_t i=0; i<probs.size(); i++) {
+		qs[i] = x[index[i]];
+	}
+	return qs;
+}
+
+
+template <typename T>
+vector<T> quantile(const vector<T> & x, const vector<double> probs, const int type=1)
+{
+	vector<T> x_selected(x.begin(), x.end());
+	return selected_quantile(x_selected, probs);
+}
+
+
 template <typename T>
-vector<T> equidist_quantile(const vector<T> & x, const int K, const double d=0, const int type=1)
+vector<T> equidist_quantile(const vector<T> & x, const int K, const double d=0,
+							const int type=1, const bool is_sorted=false)
 {
 	vector<double> 	out(K),
 					quantiles(K);
 
 	for (int i=0; i<K; i++) { quantiles[i] = (i + 1 - d) / K; }
 
-	out = quantile(x, quantiles, type);
+	out = is_sorted ? sorted_quantile(x, quantiles, type)
+					: quantile(x, quantiles, type);
 
 	return out;
 }
@@ -651,155 +924,492 @@ NumericMatrix permutations(const NumericVector x, const int num_permutations)
 
 /*=============================================
 
-		WASSERSTEIN DISTANCE CALCULATION
+				PREPARED SAMPLES
 
 ==============================================*/
 
-//' Compute the squared 2-Wasserstein distance based on a decomposition
-//'
-//' Computes the squared 2-Wasserstein distance between two vectors based on a decomposition into location, size and shape terms.
-//' For a detailed description of the (empirical) calculation of the invoved quantities, see Schefzik et al. (2020).
+// Every distance function sorts its own copies of the samples and computes
+// their moments and quantiles. A sample that is compared to many others
+// can instead be prepared once: prepare_sample returns an external pointer
+// to a prepared_sample, and the distance functions accept such handles in
+// place of numeric vectors.
+
+const int NUM_QUANTILES = 1000;
+
+//' prepared_sample
 //'
-//' @param x sample (vector) representing the distribution of condition \eqn{A}
-//' @param y sample (vector) representing the distribution of condition \eqn{B}
-//' @return A list of 4:
-//' \itemize{
-//' \item distance: the sum location+size+shape
-//' \item location: location part in the decoposition of the 2-Wasserstein distance
-//' \item size: size part in the decoposition of the 2-Wasserstein distance
-//' \item shape: shape part in the decoposition of the 2-Wasserstein distance
-//'}
-//' 
-//' @references 
-//'Schefzik, R., Flesch, J., and Goncalves, A. (2020). waddR: Using the 2-Wasserstein distance to identify differences between distributions in two-sample testing, with application to single-cell RNA-sequencing data.
+//' Sample sorted in increasing order, with its mean, standard deviation and
+//' the NUM_QUANTILES equidistant type-1 quantiles at levels (k - 0.5) /
+//' NUM_QUANTILES used by squared_wass_decomp and squared_wass_approx
 //'
-//' @seealso See the functions \code{wasserstein_metric} and \code{squared_wass_approx} for
-//' alternative implementations of the 2-Wasserstein distance
+struct prepared_sample
+{
+	vector<double> 	sorted;
+	double 			mean = 0.0,
+					sd = 0.0;
+	vector<double> 	quantiles;
+};
+
+
+//' prepared_sample_of
 //'
-//' @examples
-//' set.seed(24)
-//' x<-rnorm(100)
-//' y1<-rnorm(150)
-//' y2<-rexp(150,3)
-//' y3<-rpois(150,2)
+//' @param x non-empty sample (vector), not necessarily sorted
+//' @return x as a prepared_sample
 //'
-//' squared_wass_decomp(x,y1)
-//' squared_wass_decomp(x,y2)
-//' squared_wass_decomp(x,y3)
-//' 
-//' @export
-//[[Rcpp::export]]
-Rcpp::List squared_wass_decomp(	const NumericVector & x,
-								const NumericVector & y)
+prepared_sample prepared_sample_of(const vector<double> & x)
 {
-	vector<double> 		a(x.begin(), x.end()), b(y.begin(), y.end());
+	prepared_sample s;
 
-	if (a.empty() || b.empty()){
-		stop("squared_wass_approx: Vectors can't be empty");
+	// mean and sd in one pass over the values in the order given, as for
+	// prepared_summary_of and quantile sketches
+	moment_accumulator moments;
+	for (const double value : x) {
+		moments.add(value);
 	}
+	s.mean = moments.mean;
+	s.sd = moments.sd();
 
-	double 	location, shape, size, d, 
-			mean_a = mean(a), mean_b = mean(b),
-			sd_a = sd(a), sd_b = sd(b),
-			quantile_cor_ab;
+	s.sorted = x;
+	sort(s.sorted.begin(), s.sorted.end());
 
-	if (sd_a == 0 or sd_b == 0) {
-	
-		quantile_cor_ab = 0;
-	
-	} else {
+	s.quantiles = equidist_quantile(s.sorted, NUM_QUANTILES, (double) 0.5, 1,
+									true);
+	return s;
+}
 
-		int NUM_QUANTILES = 1000;
-		vector<double> 	quantiles_a = equidist_quantile(a, NUM_QUANTILES, (double) 0.5),
-						quantiles_b = equidist_quantile(b, NUM_QUANTILES, (double) 0.5);
 
-		quantile_cor_ab = cor(quantiles_a, quantiles_b);
-	
+//' prepared_summary_of
+//'
+//' Same mean, standard deviation and quantiles as prepared_sample_of, but
+//' without the sorted sample: the quantiles are selected rather than read
+//' from a full sort, which is all squared_wass_decomp and
+//' squared_wass_approx need.
+//'
+//' @param x non-empty sample (vector), reordered in place
+//' @return the summary of x as a prepared_sample without sorted values
+//'
+prepared_sample prepared_summary_of(vector<double> & x)
+{
+	prepared_sample s;
+	moment_accumulator moments;
+	for (const double value : x) {
+		moments.add(value);
 	}
+	s.mean = moments.mean;
+	s.sd = moments.sd();
 
+	vector<double> probs(NUM_QUANTILES);
+	for (int i=0; i<NUM_QUANTILES; i++) {
+		probs[i] = (i + 1 - 0.5) / NUM_QUANTILES;
+	}
+	s.quantiles = selected_quantile(x, probs);
+	return s;
+}
 
-	location 	= pow(mean_a - mean_b, 2);
-	size 		= pow(sd_a - sd_b, 2);
-	shape 		= abs(2 * sd_a * sd_b * (1 - quantile_cor_ab));
-	d 			= location + size + shape;
-	
-	return Rcpp::List::create(
-		Rcpp::Named("distance") = d,
-		Rcpp::Named("location") = location,
-		Rcpp::Named("size") = size,
-		Rcpp::Named("shape") = shape
-		);
+
+//' is_prepared_sample
+//'
+//' @param x R object
+//' @return TRUE if x is a handle returned by prepare_sample
+//'
+bool is_prepared_sample(SEXP x)
+{
+	return TYPEOF(x) == EXTPTRSXP && Rf_inherits(x, "prepared_sample");
 }
 
 
-//' Compute approximated squared 2-Wasserstein distance
+//' is_quantile_sketch
 //'
-//' Calculates an approximated squared 2-Wasserstein distance based on the mean squared difference between 1000 equidistant
-//' quantiles corresponding to the empirical distributions of two input vectors \eqn{x} and \eqn{y}
+//' @param x R object
+//' @return TRUE if x is a handle returned by sketch_sample
 //'
-//' @param x sample (vector) representing the distribution of condition \eqn{A}
-//' @param y sample (vector) representing the distribution of condition \eqn{B}
-//' @return The approximated squared 2-Wasserstein distance between \eqn{x} and \eqn{y}
+bool is_quantile_sketch(SEXP x)
+{
+	return TYPEOF(x) == EXTPTRSXP && Rf_inherits(x, "quantile_sketch");
+}
+
+
+//' prepared_sample_from
 //'
-//' @references Schefzik, R., Flesch, J., and Goncalves, A. (2020). waddR: Using the 2-Wasserstein distance to identify differences between distributions in two-sample testing, with application to single-cell RNA-sequencing data.
+//' @param x handle returned by prepare_sample, or a non-empty numeric vector
+//' @param scratch storage for the prepared vector x
+//' @return the prepared sample of the handle, or x prepared into scratch
 //'
-//' @seealso See the functions \code{wasserstein_metric} and \code{squared_wass_decomp} for
-//' alternative implementations of the 2-Wasserstein distance
+const prepared_sample & prepared_sample_from(SEXP x, prepared_sample & scratch)
+{
+	if (is_prepared_sample(x)) {
+		XPtr<prepared_sample> handle(x);
+		if (handle.get() == nullptr) {
+			// external pointers are not saved with the workspace
+			stop("Prepared sample is no longer valid, call prepare_sample again");
+		}
+		return *handle;
+	}
+	if (is_quantile_sketch(x)) {
+		stop("A quantile sketch only holds quantiles, not the sorted sample; use squared_wass_decomp or squared_wass_approx");
+	}
+	const NumericVector values(x);
+	scratch = prepared_sample_of(vector<double>(values.begin(), values.end()));
+	return scratch;
+}
+
+
+// like prepared_sample_from, but prepares a vector without sorting it and
+// also accepts a handle returned by sketch_sample; the result may only have
+// the mean, the standard deviation and the quantiles. Defined with the
+// quantile sketches below
+const prepared_sample & prepared_summary_from(SEXP x, prepared_sample & scratch);
+
+
+//' Prepare a sample for repeated distance computations
+//'
+//' Sorts a sample once and caches its mean, its standard deviation and its
+//' 1000 equidistant quantiles of type 1 at levels \eqn{(k-0.5)/1000}. The
+//' returned handle can be passed in place of the sample to
+//' \code{wasserstein_metric}, \code{squared_wass_decomp} and
+//' \code{squared_wass_approx}, so that comparing one sample against many
+//' others sorts it only once. The results are the same as with the sample
+//' itself.
+//'
+//' The handle is an external pointer and is not saved with the workspace;
+//' it has to be prepared again in a new R session.
+//'
+//' @param x sample (vector)
+//' @return a handle of class \code{prepared_sample}
+//'
+//' @seealso \code{\link{wasserstein_metric}}, \code{\link{squared_wass_decomp}},
+//' \code{\link{squared_wass_approx}}
 //'
 //' @examples
 //' set.seed(24)
 //' x<-rnorm(100)
-//' y1<-rnorm(150)
-//' y2<-rexp(150,3)
-//' y3<-rpois(150,2)
+//' px<-prepare_sample(x)
+//' ys<-lapply(1:5, function(i) rnorm(150, mean=i/10))
 //'
-//' squared_wass_approx(x,y1)
-//' squared_wass_approx(x,y2)
-//' squared_wass_approx(x,y3)
+//' #compare the prepared sample to several others
+//' sapply(ys, function(y) wasserstein_metric(px,y,p=2))
+//' sapply(ys, function(y) squared_wass_decomp(px,y)$distance)
 //'
 //' @export
 //[[Rcpp::export]]
-double squared_wass_approx(	const NumericVector & x,
-							const NumericVector & y)
+SEXP prepare_sample(const NumericVector x)
 {
-	vector<double> 		a(x.begin(), x.end()), b(y.begin(), y.end());
-
-	if (a.empty() || b.empty()){
-		stop("squared_wass_approx: Vectors can't be empty");
+	if (x.size() == 0) {
+		stop("prepare_sample: Vector can't be empty");
 	}
+	XPtr<prepared_sample> handle(
+		new prepared_sample(prepared_sample_of(vector<double>(x.begin(), x.end()))),
+		true);
+	handle.attr("class") = "prepared_sample";
+	return handle;
+}
 
-	double				distance_approx;
-	int 				NUM_QUANTILES = 1000;
-	vector<double> 		quantiles_a = equidist_quantile(a, NUM_QUANTILES, (double) 0.5),
-						quantiles_b = equidist_quantile(b, NUM_QUANTILES, (double) 0.5),
-						squared_quantile_diff(NUM_QUANTILES);
 
+//' wass_decomposition
+//'
+//' Decomposition of the squared 2-Wasserstein distance into location, size
+//' and shape terms, see squared_wass_decomp, and the quantile-quantile
+//' correlation rho of .quantileCorrelation
+//'
+struct wass_decomposition
+{
+	double 	location = 0.0,
+			size = 0.0,
+			shape = 0.0,
+			distance = 0.0,
+			rho = 0.0;
+};
 
-	squared_quantile_diff = pow(quantiles_a - quantiles_b, (double) 2.0);
-	distance_approx = mean(squared_quantile_diff);
 
-	return distance_approx;
+//' wass_decomposition_of
+//'
+//' @param a prepared sample representing condition A
+//' @param b prepared sample representing condition B
+//' @return the decomposition of the squared 2-Wasserstein distance between
+//'  a and b. Both correlations of the quantiles come from a single pass:
+//'  the shape term uses 0 if the standard deviation of a sample is 0, rho
+//'  uses 0 if the quantiles of a sample are constant
+//'
+wass_decomposition wass_decomposition_of(const prepared_sample & a,
+										 const prepared_sample & b)
+{
+	comoment_accumulator quantile_moments;
+	for (int k=0; k<NUM_QUANTILES; k++) {
+		quantile_moments.add(a.quantiles[k], b.quantiles[k]);
+	}
+	const double quantile_cor = quantile_moments.cor();
+
+	wass_decomposition d;
+	d.location 	= pow(a.mean - b.mean, 2);
+	d.size 		= pow(a.sd - b.sd, 2);
+	d.shape 	= abs(2 * a.sd * b.sd
+					  * (1 - ((a.sd == 0 or b.sd == 0) ? 0 : quantile_cor)));
+	d.distance 	= d.location + d.size + d.shape;
+	d.rho 		= (quantile_moments.m2_x == 0 || quantile_moments.m2_y == 0)
+				  ? 0 : quantile_cor;
+	return d;
 }
 
 
-//' Calculate the p-Wasserstein distance
+//' quantile_correlation
 //'
-//' Calculates the \eqn{p}-Wasserstein distance (metric) between two vectors \eqn{x} and \eqn{y}
+//' Pearson correlation of the 1000 equidistant quantiles of type 1 of two
+//' samples, as in .quantileCorrelation with its default levels
 //'
-//' This implementation of the \eqn{p}-Wasserstein distance is a Rcpp reimplementation of
-//' the \code{wasserstein1d} function from the R package \code{transport} by Schuhmacher et al.
-//' 
-//' @param x sample (vector) representing the distribution of condition \eqn{A}
-//' @param y sample (vector) representing the distribution of condition \eqn{B}
+//' @param x handle returned by prepare_sample, or a numeric vector
+//' @param y handle returned by prepare_sample, or a numeric vector
+//' @return the quantile-quantile correlation, or 0 if the quantiles of one
+//'  sample are constant
+//'
+//[[Rcpp::export]]
+double quantile_correlation(SEXP x, SEXP y)
+{
+	if (Rf_length(x) == 0 || Rf_length(y) == 0) {
+		stop("quantile_correlation: Vectors can't be empty");
+	}
+	prepared_sample scratch_a, scratch_b;
+	const prepared_sample 	& a = prepared_summary_from(x, scratch_a),
+							& b = prepared_summary_from(y, scratch_b);
+
+	return wass_decomposition_of(a, b).rho;
+}
+
+
+/*=============================================
+
+				POWER SUMS
+
+==============================================*/
+
+// The distance kernels below add up |b - a|^p over the intervals of two
+// quantile functions. The package almost always uses p = 2, so the power is
+// a compile-time policy of the kernels: p = 1 and p = 2 get kernels without
+// a call to pow per element, all other orders fall back to pow.
+
+//' power_1
+//'
+//' |d|^p for p = 1
+//'
+struct power_1
+{
+	double operator()(const double d) const { return abs(d); }
+};
+
+//' power_2
+//'
+//' |d|^p for p = 2
+//'
+struct power_2
+{
+	double operator()(const double d) const { return d * d; }
+};
+
+//' power_p
+//'
+//' |d|^p for any other order p
+//'
+struct power_p
+{
+	const double p;
+
+	explicit power_p(const double p) : p(p) {}
+
+	double operator()(const double d) const { return pow(abs(d), p); }
+};
+
+
+// Samples of equal sizes are compared position by position. These sums are
+// split into SUM_LANES partial sums, where position i always adds to lane
+// i % SUM_LANES, and the lanes are added up in a fixed order. The lanes are
+// independent, so the compiler vectorizes them without reordering any
+// addition, and the result does not depend on the instruction set. With
+// GCC on x86-64 Linux, the lane kernels are compiled for AVX-512, AVX2 and
+// the baseline instruction set, and the dynamic linker picks the variant
+// for the CPU when the package is loaded. Fused multiply-adds would round
+// differently on AVX-512, so they are disabled in the lane kernels.
+
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 6 \
+	&& defined(__x86_64__) && defined(__linux__) && defined(__GLIBC__)
+#define LANE_KERNEL __attribute__((target_clones("avx512f", "avx2", "default"), \
+										optimize("fp-contract=off")))
+#else
+#define LANE_KERNEL
+#endif
+
+const int SUM_LANES = 8;
+
+//' paired_difference
+//'
+//' Differences b[k] - a[k] of two runs of sample values
+//'
+struct paired_difference
+{
+	const double * a;
+	const double * b;
+
+	double operator()(const int k) const { return b[k] - a[k]; }
+};
+
+//' single_difference
+//'
+//' Differences between a run of sample values and a run of zeros. As
+//' |x - 0| = |0 - x| = |x| exactly, the side of the zeros does not matter
+//'
+struct single_difference
+{
+	const double * x;
+
+	double operator()(const int k) const { return x[k]; }
+};
+
+//' lane_sum_of
+//'
+//' Adds power(difference(k)) for k in [0, n) to the lanes, where position k
+//' adds to lane (lane0 + k) % SUM_LANES
+//'
+template <typename Power, typename Difference>
+inline void lane_sum_of(const Difference difference,
+						const int n,
+						const int lane0,
+						double * lanes,
+						const Power power)
+{
+	// work on a local copy, which the compiler keeps in vector registers
+	double lane[SUM_LANES];
+	copy(lanes, lanes + SUM_LANES, lane);
+
+	const int head = min(n, (SUM_LANES - lane0 % SUM_LANES) % SUM_LANES);
+	int k = 0;
+	for (; k<head; k++) {
+		lane[(lane0 + k) % SUM_LANES] += power(difference(k));
+	}
+	for (; k + SUM_LANES <= n; k += SUM_LANES) {
+		for (int l=0; l<SUM_LANES; l++) {
+			lane[l] += power(difference(k + l));
+		}
+	}
+	for (; k<n; k++) {
+		lane[(lane0 + k) % SUM_LANES] += power(difference(k));
+	}
+
+	copy(lane, lane + SUM_LANES, lanes);
+}
+
+// lane kernels of the orders p = 1 and p = 2, one variant per instruction set
+LANE_KERNEL
+void lane_sum_paired_1(const double * a, const double * b, const int n,
+					   const int lane0, double * lanes)
+{
+	lane_sum_of(paired_difference{a, b}, n, lane0, lanes, power_1());
+}
+
+LANE_KERNEL
+void lane_sum_paired_2(const double * a, const double * b, const int n,
+					   const int lane0, double * lanes)
+{
+	lane_sum_of(paired_difference{a, b}, n, lane0, lanes, power_2());
+}
+
+LANE_KERNEL
+void lane_sum_single_1(const double * x, const int n, const int lane0,
+					   double * lanes)
+{
+	lane_sum_of(single_difference{x}, n, lane0, lanes, power_1());
+}
+
+LANE_KERNEL
+void lane_sum_single_2(const double * x, const int n, const int lane0,
+					   double * lanes)
+{
+	lane_sum_of(single_difference{x}, n, lane0, lanes, power_2());
+}
+
+//' lane_sum
+//'
+//' Adds |b[k] - a[k]|^p for k in [0, n) to the lanes, where position k adds
+//' to lane (lane0 + k) % SUM_LANES
+//'
+//' @param a run of n values of sample A, or nullptr for a run of zeros
+//' @param b run of n values of sample B, or nullptr for a run of zeros
+//' @param n length of the runs
+//' @param lane0 position of the first value within the whole samples
 //' @param p order of the Wasserstein distance
-//' @param wa_ optional vector of weights for \code{x}
-//' @param wb_ optional vector of weights for \code{y}
-//' @return The \eqn{p}-Wasserstein distance between \eqn{x} and \eqn{y}
+//' @param lanes SUM_LANES partial sums
+//'
+void lane_sum(const double * a,
+			  const double * b,
+			  const int n,
+			  const int lane0,
+			  const double p,
+			  double * lanes)
+{
+	if (n <= 0 || (a == nullptr && b == nullptr)) {
+		return;
+	}
+	if (a == nullptr || b == nullptr) {
+		const double * x = (a == nullptr) ? b : a;
+		if (p == 2.0) {
+			lane_sum_single_2(x, n, lane0, lanes);
+		} else if (p == 1.0) {
+			lane_sum_single_1(x, n, lane0, lanes);
+		} else {
+			lane_sum_of(single_difference{x}, n, lane0, lanes, power_p(p));
+		}
+		return;
+	}
+	if (p == 2.0) {
+		lane_sum_paired_2(a, b, n, lane0, lanes);
+	} else if (p == 1.0) {
+		lane_sum_paired_1(a, b, n, lane0, lanes);
+	} else {
+		lane_sum_of(paired_difference{a, b}, n, lane0, lanes, power_p(p));
+	}
+}
+
+//' lane_total
 //'
-//' @references Schefzik, R., Flesch, J., and Goncalves, A. (2020). waddR: Using the 2-Wasserstein distance to identify differences between distributions in two-sample testing, with application to single-cell RNA-sequencing data.
+//' @param lanes SUM_LANES partial sums
+//' @return the sum of the lanes, added up pairwise in a fixed order
 //'
-//' @seealso See the functions \code{squared_wass_approx} and \code{squared_wass_decomp} for
-//' alternative implementations of the 2-Wasserstein distance.
+double lane_total(const double * lanes)
+{
+	return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3]))
+		   + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+}
+
+
+/*=============================================
+
+		WASSERSTEIN DISTANCE CALCULATION
+
+==============================================*/
+
+//' Compute the squared 2-Wasserstein distance based on a decomposition
+//'
+//' Computes the squared 2-Wasserstein distance between two vectors based on a decomposition into location, size and shape terms.
+//' For a detailed description of the (empirical) calculation of the invoved quantities, see Schefzik et al. (2020).
+//'
+//' The decomposition only uses the means, standard deviations and 1000
+//' equidistant quantiles of the samples, so that very large samples can be
+//' passed as quantile sketches, see \code{sketch_sample}.
+//'
+//' @param x sample (vector) representing the distribution of condition \eqn{A},
+//' or a handle of it returned by \code{prepare_sample} or \code{sketch_sample}
+//' @param y sample (vector) representing the distribution of condition \eqn{B},
+//' or a handle of it returned by \code{prepare_sample} or \code{sketch_sample}
+//' @return A list of 4:
+//' \itemize{
+//' \item distance: the sum location+size+shape
+//' \item location: location part in the decoposition of the 2-Wasserstein distance
+//' \item size: size part in the decoposition of the 2-Wasserstein distance
+//' \item shape: shape part in the decoposition of the 2-Wasserstein distance
+//'}
+//' 
+//' @references 
+//'Schefzik, R., Flesch, J., and Goncalves, A. (2020). waddR: Using the 2-Wasserstein distance to identify differences between distributions in two-sample testing, with application to single-cell RNA-sequencing data.
+//'
+//' @seealso See the functions \code{wasserstein_metric} and \code{squared_wass_approx} for
+//' alternative implementations of the 2-Wasserstein distance
 //'
 //' @examples
 //' set.seed(24)
@@ -808,112 +1418,1887 @@ double squared_wass_approx(	const NumericVector & x,
 //' y2<-rexp(150,3)
 //' y3<-rpois(150,2)
 //'
-//' #calculate 2-Wasserstein distance between x and y1
-//' wasserstein_metric(x,y1,p=2)
-//' #calculate squared 2-Wasserstein distance between x and y1
-//' wasserstein_metric(x,y1,p=2)^2
+//' squared_wass_decomp(x,y1)
+//' squared_wass_decomp(x,y2)
+//' squared_wass_decomp(x,y3)
+//' 
+//' @export
+//[[Rcpp::export]]
+Rcpp::List squared_wass_decomp(	SEXP x,
+								SEXP y)
+{
+	if (Rf_length(x) == 0 || Rf_length(y) == 0){
+		stop("squared_wass_approx: Vectors can't be empty");
+	}
+
+	prepared_sample 		scratch_a, scratch_b;
+	const prepared_sample 	& a = prepared_summary_from(x, scratch_a),
+							& b = prepared_summary_from(y, scratch_b);
+
+	const wass_decomposition d = wass_decomposition_of(a, b);
+	
+	return Rcpp::List::create(
+		Rcpp::Named("distance") = d.distance,
+		Rcpp::Named("location") = d.location,
+		Rcpp::Named("size") = d.size,
+		Rcpp::Named("shape") = d.shape
+		);
+}
+
+
+//' Compute approximated squared 2-Wasserstein distance
 //'
-//' #calculate 2-Wasserstein distance between x and y2
-//' wasserstein_metric(x,y2,p=2)
-//' #calculate squared 2-Wasserstein distance between x and y2
-//' wasserstein_metric(x,y2,p=2)^2
+//' Calculates an approximated squared 2-Wasserstein distance based on the mean squared difference between 1000 equidistant
+//' quantiles corresponding to the empirical distributions of two input vectors \eqn{x} and \eqn{y}
 //'
-//' #calculate 2-Wasserstein distance between x and y3
-//' wasserstein_metric(x,y3,p=2)
-//' #calculate squared 2-Wasserstein distance between x and y3
-//' wasserstein_metric(x,y3,p=2)^2
+//' @param x sample (vector) representing the distribution of condition \eqn{A},
+//' or a handle of it returned by \code{prepare_sample} or \code{sketch_sample}
+//' @param y sample (vector) representing the distribution of condition \eqn{B},
+//' or a handle of it returned by \code{prepare_sample} or \code{sketch_sample}
+//' @return The approximated squared 2-Wasserstein distance between \eqn{x} and \eqn{y}
+//'
+//' @references Schefzik, R., Flesch, J., and Goncalves, A. (2020). waddR: Using the 2-Wasserstein distance to identify differences between distributions in two-sample testing, with application to single-cell RNA-sequencing data.
+//'
+//' @seealso See the functions \code{wasserstein_metric} and \code{squared_wass_decomp} for
+//' alternative implementations of the 2-Wasserstein distance
+//'
+//' @examples
+//' set.seed(24)
+//' x<-rnorm(100)
+//' y1<-rnorm(150)
+//' y2<-rexp(150,3)
+//' y3<-rpois(150,2)
+//'
+//' squared_wass_approx(x,y1)
+//' squared_wass_approx(x,y2)
+//' squared_wass_approx(x,y3)
 //'
 //' @export
 //[[Rcpp::export]]
-double wasserstein_metric(const NumericVector x, 
-						  const NumericVector y,
-						  const double p=1,
-						  const Nullable<NumericVector> wa_=R_NilValue, 
-						  const Nullable<NumericVector> wb_=R_NilValue) 
+double squared_wass_approx(	SEXP x,
+							SEXP y)
 {
+	if (Rf_length(x) == 0 || Rf_length(y) == 0){
+		stop("squared_wass_approx: Vectors can't be empty");
+	}
 
-	vector<double> a(x.begin(), x.end());
-	vector<double> b(y.begin(), y.end());
+	prepared_sample 		scratch_a, scratch_b;
+	const prepared_sample 	& a = prepared_summary_from(x, scratch_a),
+							& b = prepared_summary_from(y, scratch_b);
 
-	if (a.empty() or b.empty()) {
-		stop("wasserstin_metric: Vectors can't be empty");
+	double				distance_approx;
+	vector<double> 		squared_quantile_diff(NUM_QUANTILES);
+
+
+	squared_quantile_diff = pow(a.quantiles - b.quantiles, (double) 2.0);
+	distance_approx = mean(squared_quantile_diff);
+
+	return distance_approx;
+}
+
+
+//' power_sum_unweighted
+//'
+//' Sum of |b - a|^p over the merged intervals of two sorted samples of
+//' unequal sizes with uniform weights. Instead of expanding both samples to
+//' a common grid of cumulative weights, the two cumulative weight sequences
+//' are merged in a single linear pass.
+//'
+//' @param a sorted sample (vector) representing condition A
+//' @param b sorted sample (vector) representing condition B
+//' @param power power policy for the order p
+//' @return The p-th power of the p-Wasserstein distance between a and b
+//'
+template <typename Power>
+double power_sum_unweighted(const vector<double> & a,
+							const vector<double> & b,
+							const Power power)
+{
+	const int m = a.size(), n = b.size();
+
+	// normalized uniform weights; the cumulative weights are accumulated in
+	// the same order as cumSum, the last one is the open interval to 1
+	const double 	ua = 1.0 / (double) m,
+					ub = 1.0 / (double) n;
+	double 	cua = ua, cub = ub,
+			lower = 0.0, upper = 0.0,
+			wsum = 0.0;
+	int 	i = 0, j = 0;
+
+	// merge the interval breaks of both samples; within each interval
+	// (lower, upper] the quantile functions are constant at a[i] and b[j]
+	while (i < m-1 || j < n-1) {
+		const bool next_a = (j == n-1) || (i < m-1 && cua <= cub);
+		upper = next_a ? cua : cub;
+		wsum += (upper - lower) * power(b[j] - a[i]);
+		lower = upper;
+		if (next_a) {
+			++i;
+			cua = ua + cua;
+		} else {
+			++j;
+			cub = ub + cub;
+		}
 	}
+	wsum += (1.0 - lower) * power(b[n-1] - a[m-1]);
 
-	sort(a.begin(), a.end());
-	sort(b.begin(), b.end());
+	return wsum;
+}
 
-	// No weight vectors are given
-	if (a.size() == b.size() && wa_.isNull() && wb_.isNull()) {
 
-		// compute root mean squared absolute difference of a and b
+//' wasserstein_sorted_unweighted
+//'
+//' p-Wasserstein distance between two sorted samples with uniform weights.
+//' The result is identical to the weighted path of wasserstein_sorted with
+//' all weights set to 1.
+//'
+//' @param a sorted sample (vector) representing condition A
+//' @param b sorted sample (vector) representing condition B
+//' @param p order of the Wasserstein distance
+//' @return The p-Wasserstein distance between a and b
+//'
+double wasserstein_sorted_unweighted(const vector<double> & a,
+									 const vector<double> & b,
+									 const double p)
+{
+	const int m = a.size(), n = b.size();
+
+	if (m == n) {
 		// in R: mean(abs(sort(b) - sort(a))^p)^(1/p)
-		vector<double> sq_abs_diff = pow(
-		  abs(b - a),
-		  p);
-		double mrsad = pow((double) mean(sq_abs_diff), (double) 1.0/p);
-		return mrsad;
+		double lanes[SUM_LANES] = {0.0};
+		lane_sum(a.data(), b.data(), m, 0, p, lanes);
+		return pow(lane_total(lanes) / m, (double) 1.0/p);
+	}
 
+	double wsum;
+	if (p == 2.0) {
+		wsum = power_sum_unweighted(a, b, power_2());
+	} else if (p == 1.0) {
+		wsum = power_sum_unweighted(a, b, power_1());
+	} else {
+		wsum = power_sum_unweighted(a, b, power_p(p));
 	}
+	return pow(wsum, (double) (1/p));
+}
 
-	// At least one weight vector is given
-	// If only one weight vector is undefined, set all its weights to 1
-	double default_weight = 1.0;
-	std::vector<double> wa(a.size(), default_weight);
-	std::vector<double> wb(b.size(), default_weight);
-
-	if (!wa_.isNull()) {
-	  	NumericVector dumpwa = wa_.get();
-		wa = vector<double>(dumpwa.begin(), dumpwa.end());
-	}
-	if (!wb_.isNull()) {
-	  	NumericVector dumpwb = wb_.get();
-		wb = vector<double>(dumpwb.begin(), dumpwb.end());
-	}
-
-	// normalize the weights to add up to 1
-	vector<double> ua(wa.size());
-	ua = wa / sum(wa);
-	ua.pop_back();
-	vector<double> ub(wb.size());
-	ub = wb / sum(wb);
-	ub.pop_back();
-	
-	// cumulative distribution without the last value
-	// => last value will be considered as an open interval to Infinity
-	vector<double> cua(ua.size());
-	cua = cumSum(ua);
-	vector<double> cub(ub.size());
-	cub = cumSum(ub);
-	vector<int> a_rep = interval_table(cub, cua, 1);
-	vector<int> b_rep = interval_table(cua, cub, 1);
-
-	int len_a_weighted = sum(a_rep);
-	int len_b_weighted = sum(b_rep);
-
-	vector<double> a_weighted(len_b_weighted);
-	vector<double> b_weighted(len_a_weighted);
-	a_weighted = rep_weighted(a, a_rep);
-	b_weighted = rep_weighted(b, b_rep);
-
-	vector<double> uu(cua.size() + cub.size());
-	vector<double> uu0(cua.size() + cub.size()+1);
-	vector<double> uu1(cua.size() + cub.size()+1);
-
-	vector<double> ONE{(double) 1.0};
-	vector<double> ZERO{(double) 0.0};
-	uu = concat(cua, cub);
-	std::sort(uu.begin(), uu.end());
-	uu0 = concat(ZERO, uu);
-	uu1 = concat(uu, ONE);
-
-	double wsum = 0.0;
-	double areap = 0.0;
-
-	wsum = sum((uu1 - uu0) * pow(abs(b_weighted - a_weighted), p));
-	areap = pow(wsum, (double) (1/p));
-
-	return areap;
 
+//' zero_atom_sample
+//'
+//' Sorted sample whose zeros are kept as one atom: only the non-zero values
+//' are stored, the zeros are represented by their count and lie between
+//' the negative and the positive values. Zero-inflated samples can thus be
+//' split and compared in time proportional to their non-zero values.
+//'
+struct zero_atom_sample
+{
+	vector<double> 	nonzero;		// sorted non-zero values
+	int 			negative = 0,	// number of negative values
+					zeros = 0;		// number of zeros
+
+	int size() const
+	{
+		return nonzero.size() + zeros;
+	}
+
+	// first position after the zero block
+	int zeros_end() const
+	{
+		return negative + zeros;
+	}
+
+	// value at position i of the sorted sample
+	double operator[](const int i) const
+	{
+		if (i < negative) {
+			return nonzero[i];
+		}
+		return (i < negative + zeros) ? 0.0 : nonzero[i - zeros];
+	}
+
+	// values from position i up to the next end of the negative values or
+	// the zero block; nullptr within the zero block
+	const double * run(const int i) const
+	{
+		if (i < negative) {
+			return nonzero.data() + i;
+		}
+		return (i < negative + zeros) ? nullptr : nonzero.data() + (i - zeros);
+	}
+};
+
+
+//' zero_atom_sample_of
+//'
+//' @param x sample (vector), not necessarily sorted
+//' @return x as a zero_atom_sample; only the non-zero values are sorted
+//'
+zero_atom_sample zero_atom_sample_of(const vector<double> & x)
+{
+	zero_atom_sample s;
+	s.nonzero.reserve(x.size());
+	for (const double value : x) {
+		if (value == 0.0) {
+			++s.zeros;
+		} else {
+			s.nonzero.push_back(value);
+		}
+	}
+	sort(s.nonzero.begin(), s.nonzero.end());
+	s.negative = lower_bound(s.nonzero.begin(), s.nonzero.end(), 0.0)
+				 - s.nonzero.begin();
+	return s;
+}
+
+
+//' cumulative_uniform_weights
+//'
+//' @param n sample size
+//' @return vector c of length n+1 with c[0] = 0 and c[k] the cumulative
+//'  uniform weight of the first k values, accumulated in the same order as
+//'  cumSum, so that c[k] is bit for bit the k-th break used by
+//'  wasserstein_sorted_unweighted
+//'
+vector<double> cumulative_uniform_weights(const int n)
+{
+	const double u = 1.0 / (double) n;
+	vector<double> c(n + 1, 0.0);
+	for (int k=1; k<=n; k++) {
+		c[k] = u + c[k-1];
+	}
+	return c;
+}
+
+
+//' power_sum_zero_atom
+//'
+//' Sum of |b - a|^p over the merged intervals of two zero-inflated samples
+//' of unequal sizes, see wasserstein_zero_atom
+//'
+//' @param a sample representing condition A
+//' @param b sample representing condition B
+//' @param cum_a cumulative_uniform_weights(a.size())
+//' @param cum_b cumulative_uniform_weights(b.size())
+//' @param power power policy for the order p
+//' @return The p-th power of the p-Wasserstein distance between a and b
+//'
+template <typename Power>
+double power_sum_zero_atom(const zero_atom_sample & a,
+						   const zero_atom_sample & b,
+						   const vector<double> & cum_a,
+						   const vector<double> & cum_b,
+						   const Power power)
+{
+	const int m = a.size(), n = b.size();
+
+	double 	cua = cum_a[1], cub = cum_b[1],
+			lower = 0.0, upper = 0.0,
+			wsum = 0.0;
+	int 	i = 0, j = 0;
+	bool 	skipped = false;
+
+	while (i < m-1 || j < n-1) {
+		if (!skipped && i >= a.negative && i < a.zeros_end()
+					 && j >= b.negative && j < b.zeros_end()) {
+			// both samples are in their zero block: jump to the first break
+			// that leaves one of the blocks. The breaks of both samples are
+			// merged in increasing order with ties going to a, so the other
+			// sample has passed all its breaks below (or, for a, up to) it
+			skipped = true;
+			const bool 	a_leaves = (a.zeros_end() < m),
+						b_leaves = (b.zeros_end() < n);
+			if (!a_leaves && !b_leaves) {
+				// both samples end with their zero blocks
+				return wsum;
+			}
+			if (a_leaves && (!b_leaves
+							 || cum_a[a.zeros_end()] <= cum_b[b.zeros_end()])) {
+				lower = cum_a[a.zeros_end()];
+				i = a.zeros_end();
+				j = lower_bound(cum_b.begin() + 1, cum_b.begin() + n, lower)
+					- (cum_b.begin() + 1);
+			} else {
+				lower = cum_b[b.zeros_end()];
+				j = b.zeros_end();
+				i = upper_bound(cum_a.begin() + 1, cum_a.begin() + m, lower)
+					- (cum_a.begin() + 1);
+			}
+			cua = cum_a[i+1];
+			cub = cum_b[j+1];
+			continue;
+		}
+
+		const bool next_a = (j == n-1) || (i < m-1 && cua <= cub);
+		upper = next_a ? cua : cub;
+		wsum += (upper - lower) * power(b[j] - a[i]);
+		lower = upper;
+		if (next_a) {
+			cua = cum_a[++i + 1];
+		} else {
+			cub = cum_b[++j + 1];
+		}
+	}
+	wsum += (1.0 - lower) * power(b[n-1] - a[m-1]);
+
+	return wsum;
+}
+
+
+//' wasserstein_zero_atom
+//'
+//' p-Wasserstein distance between two zero-inflated samples, with the same
+//' result as wasserstein_sorted_unweighted on the expanded samples. Where
+//' both quantile functions are 0, the intervals contribute exactly 0 and
+//' are skipped at once, so the cost is proportional to the non-zero values.
+//'
+//' @param a sample representing condition A
+//' @param b sample representing condition B
+//' @param p order of the Wasserstein distance
+//' @param cum_a cumulative_uniform_weights(a.size()); only used for samples
+//'  of unequal sizes
+//' @param cum_b cumulative_uniform_weights(b.size()); only used for samples
+//'  of unequal sizes
+//' @return The p-Wasserstein distance between a and b
+//'
+double wasserstein_zero_atom(const zero_atom_sample & a,
+							 const zero_atom_sample & b,
+							 const double p,
+							 const vector<double> & cum_a,
+							 const vector<double> & cum_b)
+{
+	const int m = a.size(), n = b.size();
+
+	if (m == n) {
+		// the positions at which either sample enters or leaves its zero
+		// block cut both samples into runs; runs within both zero blocks add
+		// 0 to the sum and are skipped. Every position adds to the same lane
+		// as in wasserstein_sorted_unweighted
+		int cuts[] = {0, a.negative, a.zeros_end(), b.negative, b.zeros_end(), m};
+		sort(cuts, cuts + 6);
+		double lanes[SUM_LANES] = {0.0};
+		for (int c=0; c<5; c++) {
+			if (cuts[c] < cuts[c+1]) {
+				lane_sum(a.run(cuts[c]), b.run(cuts[c]), cuts[c+1] - cuts[c],
+						 cuts[c], p, lanes);
+			}
+		}
+		return pow(lane_total(lanes) / m, (double) 1.0/p);
+	}
+
+	double wsum;
+	if (p == 2.0) {
+		wsum = power_sum_zero_atom(a, b, cum_a, cum_b, power_2());
+	} else if (p == 1.0) {
+		wsum = power_sum_zero_atom(a, b, cum_a, cum_b, power_1());
+	} else {
+		wsum = power_sum_zero_atom(a, b, cum_a, cum_b, power_p(p));
+	}
+	return pow(wsum, (double) (1/p));
+}
+
+
+//' tied_sample
+//'
+//' Sample collapsed into its distinct values, in increasing order, and
+//' their multiplicities. Count data has few distinct values, so distances
+//' between tied samples are computed in time proportional to the number of
+//' distinct values instead of the sample size.
+//'
+struct tied_sample
+{
+	vector<double> 	values;		// distinct values, increasing
+	vector<int> 	counts;		// multiplicity of each value
+	int 			size = 0;	// sum of counts
+};
+
+
+//' tied_sample_of
+//'
+//' @param x sample (vector), not necessarily sorted
+//' @return x as a tied_sample. Integer values within a range not larger
+//'  than the sample size are tallied directly without sorting; all other
+//'  samples are sorted and collapsed
+//'
+tied_sample tied_sample_of(const vector<double> & x)
+{
+	tied_sample s;
+	s.size = x.size();
+
+	double lo = x[0], hi = x[0];
+	bool integral = true;
+	for (const double value : x) {
+		integral = integral && (value == floor(value));
+		lo = min(lo, value);
+		hi = max(hi, value);
+	}
+
+	if (integral && hi - lo < (double) x.size()) {
+		vector<int> tally((int) (hi - lo) + 1, 0);
+		for (const double value : x) {
+			++tally[(int) (value - lo)];
+		}
+		for (int k=0; k<(int) tally.size(); k++) {
+			if (tally[k] > 0) {
+				s.values.push_back(lo + k);
+				s.counts.push_back(tally[k]);
+			}
+		}
+		return s;
+	}
+
+	vector<double> sorted(x.begin(), x.end());
+	sort(sorted.begin(), sorted.end());
+	for (const double value : sorted) {
+		if (s.values.empty() || value != s.values.back()) {
+			s.values.push_back(value);
+			s.counts.push_back(1);
+		} else {
+			++s.counts.back();
+		}
+	}
+	return s;
+}
+
+
+//' power_sum_tied
+//'
+//' Sum of |b - a|^p over the merged intervals of two tied samples, in
+//' multiples of 1/(m*n), see wasserstein_tied
+//'
+//' @param a tied sample representing condition A
+//' @param b tied sample representing condition B
+//' @param power power policy for the order p
+//' @return m*n times the p-th power of the p-Wasserstein distance
+//'
+template <typename Power>
+double power_sum_tied(const tied_sample & a,
+					  const tied_sample & b,
+					  const Power power)
+{
+	const int64_t 	m = a.size,
+					n = b.size,
+					grid = m * n;
+	int64_t 		break_a = a.counts[0] * n,
+					break_b = b.counts[0] * m,
+					lower = 0;
+	int 			i = 0, j = 0;
+	double 			wsum = 0.0;
+
+	// within each interval (lower, upper] the quantile functions are
+	// constant at a.values[i] and b.values[j]
+	while (lower < grid) {
+		const int64_t upper = min(break_a, break_b);
+		wsum += (double) (upper - lower) * power(b.values[j] - a.values[i]);
+		lower = upper;
+		if (upper == grid) {
+			break;
+		}
+		if (break_a == upper) {
+			break_a += a.counts[++i] * n;
+		}
+		if (break_b == upper) {
+			break_b += b.counts[++j] * m;
+		}
+	}
+
+	return wsum;
+}
+
+
+//' wasserstein_tied
+//'
+//' Exact p-Wasserstein distance between two tied samples, following the
+//' semantics of wasserstein_sorted_unweighted. Both quantile functions are
+//' merged on the common grid of multiples of 1/(m*n): the break after the
+//' first k values of a lies at k*n, the one of b at k*m. The breaks are
+//' thus compared exactly in integer arithmetic, and the result agrees with
+//' the merge over cumulative weights up to floating-point rounding.
+//'
+//' @param a tied sample representing condition A
+//' @param b tied sample representing condition B
+//' @param p order of the Wasserstein distance
+//' @return The p-Wasserstein distance between a and b
+//'
+double wasserstein_tied(const tied_sample & a,
+						const tied_sample & b,
+						const double p)
+{
+	const double grid = (double) a.size * (double) b.size;
+	double wsum;
+	if (p == 2.0) {
+		wsum = power_sum_tied(a, b, power_2());
+	} else if (p == 1.0) {
+		wsum = power_sum_tied(a, b, power_1());
+	} else {
+		wsum = power_sum_tied(a, b, power_p(p));
+	}
+	return pow(wsum / grid, (double) 1.0/p);
+}
+
+
+//' power_sum_weighted
+//'
+//' Sum of |b - a|^p over the merged intervals of two weighted sorted
+//' samples, see wasserstein_sorted
+//'
+//' @param a sorted sample (vector) representing condition A
+//' @param b sorted sample (vector) representing condition B
+//' @param wa_ weights for a; all weights are 1 if empty
+//' @param wb_ weights for b; all weights are 1 if empty
+//' @param power power policy for the order p
+//' @return The p-th power of the p-Wasserstein distance between a and b
+//'
+template <typename Power>
+double power_sum_weighted(const vector<double> & a,
+						  const vector<double> & b,
+						  const vector<double> & wa_,
+						  const vector<double> & wb_,
+						  const Power power)
+{
+	const int 		m = a.size(), n = b.size();
+	const double 	sum_a = wa_.empty() ? (double) m : sum(wa_),
+					sum_b = wb_.empty() ? (double) n : sum(wb_);
+	auto ua = [&](const int k) { return (wa_.empty() ? 1.0 : wa_[k]) / sum_a; };
+	auto ub = [&](const int k) { return (wb_.empty() ? 1.0 : wb_[k]) / sum_b; };
+
+	// single pass over the merged breaks of both cumulative weight
+	// sequences, without materializing them. The normalized weights and
+	// their cumulative sums are computed as in cumSum, the last value of
+	// each sample is the open interval to 1. Breaks of a go first on ties,
+	// which gives the repetitions of interval_table
+	double 	cua = ua(0), cub = ub(0),
+			lower = 0.0, upper = 0.0,
+			wsum = 0.0;
+	int 	i = 0, j = 0;
+
+	while (i < m-1 || j < n-1) {
+		const bool next_a = (j == n-1) || (i < m-1 && cua <= cub);
+		upper = next_a ? cua : cub;
+		wsum += (upper - lower) * power(b[j] - a[i]);
+		lower = upper;
+		if (next_a) {
+			++i;
+			cua = ua(i) + cua;
+		} else {
+			++j;
+			cub = ub(j) + cub;
+		}
+	}
+	wsum += (1.0 - lower) * power(b[n-1] - a[m-1]);
+
+	return wsum;
+}
+
+
+//' wasserstein_sorted
+//'
+//' p-Wasserstein distance between two samples that are already sorted in
+//' increasing order, following the semantics of wasserstein_metric.
+//'
+//' @param a sorted sample (vector) representing condition A
+//' @param b sorted sample (vector) representing condition B
+//' @param p order of the Wasserstein distance
+//' @param wa_ weights for a; uniform weights are used if empty
+//' @param wb_ weights for b; uniform weights are used if empty
+//' @return The p-Wasserstein distance between a and b
+//'
+double wasserstein_sorted(const vector<double> & a,
+						  const vector<double> & b,
+						  const double p,
+						  const vector<double> & wa_ = vector<double>(),
+						  const vector<double> & wb_ = vector<double>())
+{
+	// No weight vectors are given
+	if (wa_.empty() && wb_.empty()) {
+		return wasserstein_sorted_unweighted(a, b, p);
+	}
+
+	// At least one weight vector is given
+	// If only one weight vector is undefined, all its weights are 1
+	double wsum;
+	if (p == 2.0) {
+		wsum = power_sum_weighted(a, b, wa_, wb_, power_2());
+	} else if (p == 1.0) {
+		wsum = power_sum_weighted(a, b, wa_, wb_, power_1());
+	} else {
+		wsum = power_sum_weighted(a, b, wa_, wb_, power_p(p));
+	}
+	return pow(wsum, (double) (1/p));
+}
+
+
+//' weights_of
+//'
+//' @param w_ optional weights of wasserstein_metric
+//' @param n size of the weighted sample
+//' @return the weights, or an empty vector if w_ is NULL
+//'
+vector<double> weights_of(const Nullable<NumericVector> & w_, const size_t n)
+{
+	if (w_.isNull()) {
+		return vector<double>();
+	}
+	NumericVector dumpw = w_.get();
+	if (dumpw.size() != 0 && (size_t) dumpw.size() != n) {
+		stop("wasserstein_metric: Weights must have the length of their sample");
+	}
+	return vector<double>(dumpw.begin(), dumpw.end());
+}
+
+
+//' Calculate the p-Wasserstein distance
+//'
+//' Calculates the \eqn{p}-Wasserstein distance (metric) between two vectors \eqn{x} and \eqn{y}
+//'
+//' This implementation of the \eqn{p}-Wasserstein distance is a Rcpp reimplementation of
+//' the \code{wasserstein1d} function from the R package \code{transport} by Schuhmacher et al.
+//' 
+//' @param x sample (vector) representing the distribution of condition \eqn{A},
+//' or a handle of it returned by \code{prepare_sample}
+//' @param y sample (vector) representing the distribution of condition \eqn{B},
+//' or a handle of it returned by \code{prepare_sample}
+//' @param p order of the Wasserstein distance
+//' @param wa_ optional vector of weights for \code{x}
+//' @param wb_ optional vector of weights for \code{y}
+//' @param collapse_ties logical; if TRUE, each sample is collapsed into its
+//'  distinct values and their multiplicities before the distance is
+//'  computed, so that the cost depends on the number of distinct values
+//'  rather than on the sample size. This pays off for count data with many
+//'  ties, such as raw UMI counts. The result is the same exact distance, up
+//'  to floating-point rounding. Only available without weights; default is
+//'  FALSE
+//' @return The \eqn{p}-Wasserstein distance between \eqn{x} and \eqn{y}
+//'
+//' @references Schefzik, R., Flesch, J., and Goncalves, A. (2020). waddR: Using the 2-Wasserstein distance to identify differences between distributions in two-sample testing, with application to single-cell RNA-sequencing data.
+//'
+//' @seealso See the functions \code{squared_wass_approx} and \code{squared_wass_decomp} for
+//' alternative implementations of the 2-Wasserstein distance.
+//'
+//' @examples
+//' set.seed(24)
+//' x<-rnorm(100)
+//' y1<-rnorm(150)
+//' y2<-rexp(150,3)
+//' y3<-rpois(150,2)
+//'
+//' #calculate 2-Wasserstein distance between x and y1
+//' wasserstein_metric(x,y1,p=2)
+//' #calculate squared 2-Wasserstein distance between x and y1
+//' wasserstein_metric(x,y1,p=2)^2
+//'
+//' #calculate 2-Wasserstein distance between x and y2
+//' wasserstein_metric(x,y2,p=2)
+//' #calculate squared 2-Wasserstein distance between x and y2
+//' wasserstein_metric(x,y2,p=2)^2
+//'
+//' #calculate 2-Wasserstein distance between x and y3
+//' wasserstein_metric(x,y3,p=2)
+//' #calculate squared 2-Wasserstein distance between x and y3
+//' wasserstein_metric(x,y3,p=2)^2
+//' #the same for the count data in y3, collapsed into distinct values
+//' wasserstein_metric(x,y3,p=2,collapse_ties=TRUE)^2
+//'
+//' @export
+//[[Rcpp::export]]
+double wasserstein_metric(SEXP x, 
+						  SEXP y,
+						  const double p=1,
+						  const Nullable<NumericVector> wa_=R_NilValue, 
+						  const Nullable<NumericVector> wb_=R_NilValue,
+						  const bool collapse_ties=false) 
+{
+
+	if (Rf_length(x) == 0 or Rf_length(y) == 0) {
+		stop("wasserstin_metric: Vectors can't be empty");
+	}
+	if (collapse_ties && (!wa_.isNull() || !wb_.isNull())) {
+		stop("wasserstein_metric: collapse_ties is only available without weights");
+	}
+
+	// prepared samples are already sorted; the distance between sorted
+	// samples is the same as the one of the zero-atom path below
+	if (is_prepared_sample(x) || is_prepared_sample(y)) {
+		prepared_sample 		scratch_a, scratch_b;
+		const prepared_sample 	& pa = prepared_sample_from(x, scratch_a),
+								& pb = prepared_sample_from(y, scratch_b);
+		if (collapse_ties) {
+			return wasserstein_tied(tied_sample_of(pa.sorted),
+									tied_sample_of(pb.sorted), p);
+		}
+		return wasserstein_sorted(pa.sorted, pb.sorted, p,
+								  weights_of(wa_, pa.sorted.size()),
+								  weights_of(wb_, pb.sorted.size()));
+	}
+
+	const NumericVector 	xv(x), yv(y);
+	vector<double> a(xv.begin(), xv.end());
+	vector<double> b(yv.begin(), yv.end());
+
+	if (collapse_ties) {
+		return wasserstein_tied(tied_sample_of(a), tied_sample_of(b), p);
+	}
+
+	// unweighted samples with zeros keep the zeros as one atom, so only
+	// their non-zero values are sorted and walked
+	if (wa_.isNull() && wb_.isNull()
+		&& (find(a.begin(), a.end(), 0.0) != a.end()
+			|| find(b.begin(), b.end(), 0.0) != b.end())) {
+		zero_atom_sample za = zero_atom_sample_of(a),
+						 zb = zero_atom_sample_of(b);
+		if (za.size() == zb.size()) {
+			return wasserstein_zero_atom(za, zb, p, vector<double>(),
+										 vector<double>());
+		}
+		return wasserstein_zero_atom(za, zb, p,
+									 cumulative_uniform_weights(za.size()),
+									 cumulative_uniform_weights(zb.size()));
+	}
+
+	sort(a.begin(), a.end());
+	sort(b.begin(), b.end());
+
+	// If only one weight vector is undefined, its weights are set to 1
+	// within wasserstein_sorted
+	return wasserstein_sorted(a, b, p, weights_of(wa_, a.size()),
+							  weights_of(wb_, b.size()));
+}
+
+
+//' relative_error
+//'
+//' @return the relative error |1 - x/y| between x and y, as .relativeError
+//'
+double relative_error(const double x, const double y)
+{
+	if ((x == y) || ((x == 0) && (y == 0))) {
+		return 0;
+	}
+	return abs(1 - (x / y));
+}
+
+
+//' wass_statistics
+//'
+//' Distance statistics of the two-sample tests: the 2-Wasserstein
+//' distance, its decomposition, the quantile-quantile correlation, the
+//' percentages of the decomposition terms and the relative error of the
+//' decomposition, computed with one sort per sample. The fields are those
+//' of the test results of .wassersteinTestSp and .wassersteinTestAsy except
+//' for the p-values
+//'
+//' @param x sample (vector) representing condition A, or a handle returned
+//'  by prepare_sample
+//' @param y sample (vector) representing condition B, or a handle returned
+//'  by prepare_sample
+//' @param relative_to_comp logical; if FALSE, decomp.error is the relative
+//'  error of d.comp^2 with respect to d.wass^2 (semi-parametric test), if
+//'  TRUE the one of d.wass^2 with respect to d.comp^2 (asymptotic test)
+//' @return named vector with d.wass, d.wass^2, d.comp^2, d.comp, location,
+//'  size, shape, rho, perc.loc, perc.size, perc.shape and decomp.error
+//'
+//[[Rcpp::export]]
+NumericVector wass_statistics(SEXP x, SEXP y, const bool relative_to_comp=false)
+{
+	if (Rf_length(x) == 0 || Rf_length(y) == 0) {
+		stop("wass_statistics: Vectors can't be empty");
+	}
+	prepared_sample 		scratch_a, scratch_b;
+	const prepared_sample 	& a = prepared_sample_from(x, scratch_a),
+							& b = prepared_sample_from(y, scratch_b);
+
+	const double 	value = wasserstein_sorted(a.sorted, b.sorted, 2.0),
+					value_sq = value * value;
+	const wass_decomposition d = wass_decomposition_of(a, b);
+
+	// as in R: sum(na.exclude(location, shape, size)), which only keeps
+	// the location
+	double d_comp_sq = d.distance;
+	if (ISNAN(d_comp_sq)) {
+		d_comp_sq = ISNAN(d.location) ? 0 : d.location;
+	}
+
+	NumericVector out = NumericVector::create(
+		value, value_sq, d_comp_sq, sqrt(d_comp_sq),
+		d.location, d.size, d.shape, d.rho,
+		R::fround((d.location / d_comp_sq) * 100, 2),
+		R::fround((d.size / d_comp_sq) * 100, 2),
+		R::fround((d.shape / d_comp_sq) * 100, 2),
+		relative_to_comp ? relative_error(value_sq, d_comp_sq)
+						 : relative_error(d_comp_sq, value_sq));
+	out.names() = CharacterVector::create(
+		"d.wass", "d.wass^2", "d.comp^2", "d.comp",
+		"location", "size", "shape", "rho",
+		"perc.loc", "perc.size", "perc.shape", "decomp.error");
+	return out;
+}
+
+
+//' asy_test_statistic
+//'
+//' Test statistic of the asymptotic test, as computed in R by
+//' \preformatted{pr <- seq(from=0, to=1, by=1/10000)
+//' trf <- (ecdf(y)(quantile(x, probs=pr, type=1)) - pr)^2
+//' m*n/(m+n) * sum(trf)/length(pr)}
+//' The quantiles of x increase with the levels, so the empirical cdf of y
+//' is evaluated by one merge walk over the sorted samples. The squares are
+//' summed in extended precision like R's sum, so the statistic agrees with
+//' the R expression
+//'
+//' @param x sample (vector) representing condition A, or a handle returned
+//'  by prepare_sample
+//' @param y sample (vector) representing condition B, or a handle returned
+//'  by prepare_sample
+//' @return the test statistic, which is asymptotically distributed as the
+//'  integral of the squared Brownian bridge
+//'
+//[[Rcpp::export]]
+double asy_test_statistic(SEXP x, SEXP y)
+{
+	if (Rf_length(x) == 0 || Rf_length(y) == 0) {
+		stop("asy_test_statistic: Vectors can't be empty");
+	}
+	prepared_sample 		scratch_a, scratch_b;
+	const prepared_sample 	& a = prepared_sample_from(x, scratch_a),
+							& b = prepared_sample_from(y, scratch_b);
+
+	const int 		NUM_LEVELS = 10000,
+					m = a.sorted.size(),
+					n = b.sorted.size();
+	const double 	by = 1.0 / NUM_LEVELS;
+
+	long double 	sum_trf = 0.0;
+	int 			below = 0;		// number of values of b <= quantile
+	for (int k=0; k<=NUM_LEVELS; k++) {
+		// level as in seq(), quantile of type 1 as in sorted_quantile
+		const double 	pr = min(0 + k * by, 1.0),
+						nppm = m * pr,
+						j = floor(nppm);
+		const double 	q = a.sorted[(nppm > j) ? (int) j : max((int) j - 1, 0)];
+		while (below < n && b.sorted[below] <= q) {
+			++below;
+		}
+		const double trf = (double) below / n - pr;
+		sum_trf += trf * trf;
+	}
+
+	const double trf_int = (1.0 / (NUM_LEVELS + 1)) * (double) sum_trf;
+	return ((double) m * n / (m + n)) * trf_int;
+}
+
+
+/*=============================================
+
+			PERMUTATION PROCEDURE
+
+==============================================*/
+
+//' permutation_tail
+//'
+//' Keeps the largest values of a stream of permutation statistics in a
+//' min-heap of fixed capacity, so that the upper tail needed for the GPD
+//' fitting can be collected without storing all statistics.
+//'
+class permutation_tail
+{
+public:
+	permutation_tail(const int capacity) : capacity(capacity) {}
+
+	void push(const double value)
+	{
+		if (capacity <= 0) {
+			return;
+		}
+		if ((int) heap.size() < capacity) {
+			heap.push(value);
+		} else if (value > heap.top()) {
+			heap.pop();
+			heap.push(value);
+		}
+	}
+
+	// bytes of the collected values
+	size_t bytes() const
+	{
+		return heap.size() * sizeof(double);
+	}
+
+	// returns the collected values in decreasing order
+	vector<double> decreasing()
+	{
+		vector<double> out(heap.size());
+		for (int i=out.size()-1; i>=0; i--) {
+			out[i] = heap.top();
+			heap.pop();
+		}
+		return out;
+	}
+
+private:
+	const int capacity;
+	priority_queue<double, vector<double>, greater<double> > heap;
+};
+
+
+//' counter_rng
+//'
+//' Counter-based random number generator: the k-th number of a stream is a
+//' bijective hash (SplitMix64 finalizer) of the stream key and k, and the
+//' key is derived from a seed and a stream index. Every permutation draws
+//' from its own stream, so its outcome does not depend on which thread
+//' evaluates it or on how many permutations were drawn before.
+//'
+class counter_rng
+{
+public:
+	counter_rng(const uint64_t seed, const uint64_t stream)
+		: key(mix(seed + mix(stream + GOLDEN))), counter(0) {}
+
+	// next 32 random bits of the stream
+	uint32_t next()
+	{
+		++counter;
+		return (uint32_t) (mix(key + counter * GOLDEN) >> 32);
+	}
+
+	// uniformly distributed integer in [0, range), using Lemire's
+	// multiply-and-reject method to avoid modulo bias
+	uint32_t index(const uint32_t range)
+	{
+		uint64_t m = (uint64_t) next() * (uint64_t) range;
+		uint32_t low = (uint32_t) m;
+		if (low < range) {
+			const uint32_t threshold = (0u - range) % range;
+			while (low < threshold) {
+				m = (uint64_t) next() * (uint64_t) range;
+				low = (uint32_t) m;
+			}
+		}
+		return (uint32_t) (m >> 32);
+	}
+
+private:
+	static uint64_t mix(uint64_t z)
+	{
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		return z ^ (z >> 31);
+	}
+
+	static const uint64_t GOLDEN = 0x9E3779B97F4A7C15ULL;
+	const uint64_t key;
+	uint64_t counter;
+};
+
+
+//' draw_seed
+//'
+//' Draws a 64 bit seed for the counter-based generator from R's random
+//' number generator, so that set.seed() keeps native permutations
+//' reproducible.
+//'
+//' @return a 64 bit seed
+//'
+uint64_t draw_seed()
+{
+	const double range = 4294967296.0;
+	uint64_t high = (uint64_t) R_unif_index(range);
+	uint64_t low = (uint64_t) R_unif_index(range);
+	return (high << 32) | low;
+}
+
+
+//' permutation_pool
+//'
+//' Pooled sample of a permutation procedure, shared read-only by all
+//' samplers. Pools in which zeros are the majority are kept as a
+//' zero_atom_sample; all others are kept sorted.
+//'
+struct permutation_pool
+{
+	int 				n, n_x;
+	bool 				zero_atoms;
+	vector<double> 		sorted;
+	zero_atom_sample 	atoms;
+	vector<double> 		cum_x, cum_y;	// breaks for unequal group sizes
+
+	permutation_pool(const NumericVector & x, const NumericVector & y)
+		: n(x.size() + y.size()), n_x(x.size())
+	{
+		vector<double> values(n);
+		copy(x.begin(), x.end(), values.begin());
+		copy(y.begin(), y.end(), values.begin() + n_x);
+
+		const int zeros = count(values.begin(), values.end(), 0.0);
+		zero_atoms = (zeros > 0 && 2 * zeros >= n);
+		if (zero_atoms) {
+			atoms = zero_atom_sample_of(values);
+			if (n_x != n - n_x) {
+				cum_x = cumulative_uniform_weights(n_x);
+				cum_y = cumulative_uniform_weights(n - n_x);
+			}
+		} else {
+			sort(values.begin(), values.end());
+			sorted.swap(values);
+		}
+	}
+
+	// bytes of the buffers of the pool
+	size_t bytes() const
+	{
+		return (sorted.capacity() + atoms.nonzero.capacity()
+				+ cum_x.capacity() + cum_y.capacity()) * sizeof(double);
+	}
+};
+
+
+//' label_sets
+//'
+//' Read-only view of shared permutation label sets as built by
+//' permutation_labels: one bitset of n bits per permutation, stored in
+//' consecutive 64 bit words, in which bit k is set if position k of the
+//' sorted pool belongs to x. The sets only depend on the group sizes, so
+//' they can be drawn once and applied to every gene.
+//'
+struct label_sets
+{
+	int 					n, n_x, words, count;
+	const unsigned char * 	bits;
+
+	label_sets(const List & labels)
+	{
+		const RawVector raw = labels["bits"];
+		n_x = as<int>(labels["n.x"]);
+		n = n_x + as<int>(labels["n.y"]);
+		words = (n + 63) / 64;
+		count = raw.size() / (8 * words);
+		bits = raw.begin();
+	}
+
+	// word w of the label set of permutation perm
+	uint64_t word(const int perm, const int w) const
+	{
+		uint64_t out;
+		memcpy(&out, bits + 8 * ((size_t) perm * words + w), 8);
+		return out;
+	}
+
+	// number of positions in [first, last) that belong to x
+	int count_x(const int perm, const int first, const int last) const
+	{
+		int total = 0;
+		for (int w=first/64; w*64<last; w++) {
+			uint64_t mask = word(perm, w);
+			if (w == first / 64) {
+				mask &= ~0ULL << (first % 64);
+			}
+			if ((w + 1) * 64 > last) {
+				mask &= ~0ULL >> (64 - last % 64);
+			}
+			total += __builtin_popcountll(mask);
+		}
+		return total;
+	}
+};
+
+
+//' permutation_sampler
+//'
+//' Draws single permutations of a pooled sample and evaluates their
+//' squared 2-Wasserstein distance. The pool is shared and only read; each
+//' sampler owns the buffers for one thread.
+//'
+class permutation_sampler
+{
+public:
+	permutation_sampler(const permutation_pool & pool, const uint64_t seed,
+						const label_sets * labels=nullptr)
+		: pool(pool), n(pool.n), n_x(pool.n_x), seed(seed), labels(labels)
+	{
+		if (pool.zero_atoms) {
+			const int nnz = pool.atoms.nonzero.size();
+			a_atoms.nonzero.reserve(min(nnz, n_x));
+			b_atoms.nonzero.reserve(min(nnz, n - n_x));
+		} else {
+			a.resize(n_x);
+			b.resize(n - n_x);
+			drawn.resize(n, 0);
+		}
+	}
+
+	// bytes of the buffers of the sampler
+	size_t bytes() const
+	{
+		return (a.capacity() + b.capacity() + a_atoms.nonzero.capacity()
+				+ b_atoms.nonzero.capacity()) * sizeof(double)
+			   + drawn.capacity();
+	}
+
+	// squared 2-Wasserstein distance of the permutation with the given index
+	double statistic(const uint64_t index)
+	{
+		double d;
+		if (labels) {
+			d = pool.zero_atoms ? split_zero_atoms(index) : split_sorted(index);
+		} else {
+			counter_rng rng(seed, index);
+			d = pool.zero_atoms ? split_zero_atoms(rng) : split_sorted(rng);
+		}
+		return d * d;
+	}
+
+private:
+	// 2-Wasserstein distance of a random split of the sorted pool
+	double split_sorted(counter_rng & rng)
+	{
+		// only the smaller group has to be drawn; the remaining elements
+		// of the pool form the other group
+		const int n_draw = min(n_x, n - n_x);
+		vector<double> & drawn_sample = (n_draw == n_x) ? a : b;
+		vector<double> & other_sample = (n_draw == n_x) ? b : a;
+
+		// Floyd's algorithm: marks a uniformly drawn subset of n_draw
+		// positions without touching the other positions
+		for (int j=n-n_draw; j<n; j++) {
+			int t = rng.index((uint32_t) (j + 1));
+			if (drawn[t]) {
+				drawn[j] = 1;
+			} else {
+				drawn[t] = 1;
+			}
+		}
+
+		// splitting the sorted pool by label keeps both samples sorted
+		int i_drawn = 0, i_other = 0;
+		for (int k=0; k<n; k++) {
+			if (drawn[k]) {
+				drawn_sample[i_drawn++] = pool.sorted[k];
+				drawn[k] = 0;
+			} else {
+				other_sample[i_other++] = pool.sorted[k];
+			}
+		}
+
+		return wasserstein_sorted_unweighted(a, b, 2.0);
+	}
+
+	// 2-Wasserstein distance of a random split of a zero-inflated pool
+	double split_zero_atoms(counter_rng & rng)
+	{
+		// selection sampling over the non-zero values only: the k-th value
+		// joins x with probability (free places in x) / (values left).
+		// The zeros are interchangeable, so afterwards they just fill the
+		// free places of both groups
+		const zero_atom_sample & atoms = pool.atoms;
+		const int nnz = atoms.nonzero.size();
+		int free_x = n_x;
+
+		a_atoms.nonzero.clear();
+		b_atoms.nonzero.clear();
+		a_atoms.negative = b_atoms.negative = 0;
+		for (int k=0; k<nnz; k++) {
+			const bool to_x = ((int) rng.index((uint32_t) (n - k)) < free_x);
+			zero_atom_sample & target = to_x ? a_atoms : b_atoms;
+			target.nonzero.push_back(atoms.nonzero[k]);
+			if (k < atoms.negative) {
+				++target.negative;
+			}
+			if (to_x) {
+				--free_x;
+			}
+		}
+		a_atoms.zeros = free_x;
+		b_atoms.zeros = atoms.zeros - free_x;
+
+		return wasserstein_zero_atom(a_atoms, b_atoms, 2.0,
+									 pool.cum_x, pool.cum_y);
+	}
+
+	// 2-Wasserstein distance of the split of the sorted pool given by a
+	// shared label set
+	double split_sorted(const int perm)
+	{
+		int i_a = 0, i_b = 0;
+		for (int w=0; w<labels->words; w++) {
+			const uint64_t 	bits = labels->word(perm, w);
+			const int 		last = min(n, 64 * (w + 1));
+			for (int k=64*w; k<last; k++) {
+				if ((bits >> (k % 64)) & 1) {
+					a[i_a++] = pool.sorted[k];
+				} else {
+					b[i_b++] = pool.sorted[k];
+				}
+			}
+		}
+		return wasserstein_sorted_unweighted(a, b, 2.0);
+	}
+
+	// 2-Wasserstein distance of the split of a zero-inflated pool given by
+	// a shared label set: the zeros of x are counted by popcount, only the
+	// non-zero positions are visited
+	double split_zero_atoms(const int perm)
+	{
+		const zero_atom_sample & atoms = pool.atoms;
+		const int 	zeros_x = labels->count_x(perm, atoms.negative,
+											  atoms.zeros_end());
+
+		a_atoms.nonzero.clear();
+		b_atoms.nonzero.clear();
+		a_atoms.negative = b_atoms.negative = 0;
+		// negative values, then positive values, in sorted order
+		const int ranges[2][2] = {{0, atoms.negative}, {atoms.zeros_end(), n}};
+		for (const auto & range : ranges) {
+			for (int k=range[0]; k<range[1]; k++) {
+				const bool to_x = (labels->word(perm, k / 64) >> (k % 64)) & 1;
+				zero_atom_sample & target = to_x ? a_atoms : b_atoms;
+				target.nonzero.push_back(atoms[k]);
+				if (k < atoms.negative) {
+					++target.negative;
+				}
+			}
+		}
+		a_atoms.zeros = zeros_x;
+		b_atoms.zeros = atoms.zeros - zeros_x;
+
+		return wasserstein_zero_atom(a_atoms, b_atoms, 2.0,
+									 pool.cum_x, pool.cum_y);
+	}
+
+	const permutation_pool & pool;
+	const int n, n_x;
+	const uint64_t seed;
+	const label_sets * labels;
+	vector<double> a, b;
+	vector<char> drawn;
+	zero_atom_sample a_atoms, b_atoms;
+};
+
+
+//' permutation_engine
+//'
+//' Evaluates ranges of permutations of the pooled sample of x and y on a
+//' pool of native threads. The pooled sample is sorted once; each
+//' permutation then costs O(n), or O(number of non-zero values) for
+//' zero-inflated samples. Because permutation i always draws from stream i
+//' of the counter-based generator, the statistics are identical for any
+//' number of threads. With shared label sets, permutation i applies label
+//' set i to the sorted pool instead of drawing from the generator.
+//'
+class permutation_engine
+{
+public:
+	permutation_engine(const NumericVector & x, const NumericVector & y,
+					   const uint64_t seed, const int threads,
+					   const label_sets * labels=nullptr)
+		: pool(x, y), threads(max(threads, 1))
+	{
+		for (int t=0; t<this->threads; t++) {
+			samplers.push_back(permutation_sampler(pool, seed, labels));
+		}
+	}
+
+	// bytes of the buffers of the pool and of all samplers
+	size_t bytes() const
+	{
+		size_t total = pool.bytes();
+		for (const permutation_sampler & sampler : samplers) {
+			total += sampler.bytes();
+		}
+		return total;
+	}
+
+	// writes the statistics of permutations [first, last) to out
+	void evaluate(const int first, const int last, double * out)
+	{
+		const int 	count = last - first,
+					n_threads = max(1, min(threads, count / MIN_PER_THREAD));
+
+		auto run_block = [&](const int t) {
+			const int 	block_first = first + (int) ((int64_t) count * t / n_threads),
+						block_last = first + (int) ((int64_t) count * (t+1) / n_threads);
+			for (int perm=block_first; perm<block_last; perm++) {
+				out[perm - first] = samplers[t].statistic(perm);
+			}
+		};
+
+		vector<thread> workers;
+		for (int t=1; t<n_threads; t++) {
+			try {
+				workers.push_back(thread(run_block, t));
+			} catch (const system_error &) {
+				// no more threads available: evaluate the block here
+				run_block(t);
+			}
+		}
+		run_block(0);
+		for (thread & worker : workers) {
+			worker.join();
+		}
+	}
+
+private:
+	// below this number of permutations per thread, threads don't pay off
+	static const int MIN_PER_THREAD = 64;
+
+	const permutation_pool pool;
+	const int threads;
+	vector<permutation_sampler> samplers;
+};
+
+
+// Whether the 99% Wilson score interval of a permutation p-value with
+// num_extr exceedances in num_perm permutations still contains alpha. An
+// interval below alpha only counts with at least 10 exceedances; with less,
+// the p-value is left to the GPD approximation on all permutations.
+static bool wilson_straddles(const int num_extr, const int num_perm,
+							 const double alpha)
+{
+	const double 	z = 2.5758293035489,
+					n = num_perm,
+					p = num_extr / n,
+					center = (p + z * z / (2 * n)) / (1 + z * z / n),
+					half = z * sqrt(p * (1 - p) / n + z * z / (4 * n * n))
+							/ (1 + z * z / n);
+
+	if (center - half > alpha) {
+		return false;
+	}
+	return !(center + half < alpha && num_extr >= 10);
+}
+
+
+//' Permutation procedure for the squared 2-Wasserstein distance
+//'
+//' Runs the complete permutation loop of the semi-parametric test natively.
+//' The pooled sample is sorted once; each permutation then only draws a new
+//' group assignment and splits the sorted pool into two already sorted
+//' samples, so that a permutation costs O(n) instead of O(n log n). If
+//' most of the pooled values are zero, the zeros are kept as one atom and
+//' a permutation only assigns the non-zero values to the groups.
+//' Permutations are evaluated in blocks on up to \code{threads} native
+//' threads. Each permutation draws from its own stream of a counter-based
+//' generator seeded from R's random number generator, so results are
+//' reproducible with set.seed() and identical for any number of threads.
+//' Memory stays O(n) per thread regardless of the number of permutations.
+//'
+//' @param x sample (vector) representing the distribution of condition A
+//' @param y sample (vector) representing the distribution of condition B
+//' @param num_permutations number of permutations to be performed
+//' @param value_sq squared 2-Wasserstein distance of the original samples,
+//'  used for counting exceedances
+//' @param tail_size if 0, all permutation statistics are returned;
+//'  otherwise only the exceedance count and the tail_size largest statistics
+//' @param threads number of native threads used for the permutations
+//' @param max_exceedances if positive (and tail_size > 0), sequential mode
+//'  of Besag and Clifford (1991): the procedure stops as soon as
+//'  max_exceedances statistics >= value_sq have been observed
+//' @param alpha if not NA (and tail_size > 0), adaptive mode: the
+//'  permutations are performed in growing blocks, and the procedure stops
+//'  after a block as soon as the 99\% Wilson confidence interval of the
+//'  p-value lies entirely above alpha, or entirely below alpha with at
+//'  least 10 exceedances. Samples with fewer exceedances below alpha get
+//'  all num_permutations for the GPD approximation
+//' @param labels if not NULL, shared label sets of the group sizes of x and
+//'  y as returned by permutation_labels: permutation i applies label set i
+//'  to the sorted pool, and no random numbers are drawn
+//' @return either a vector of num_permutations squared 2-Wasserstein
+//'  distances, or a list with num.extr (number of statistics >= value_sq),
+//'  num.perm (number of permutations performed, smaller than
+//'  num_permutations if the sequential or adaptive procedure stopped early),
+//'  stopped (whether the sequential procedure reached max_exceedances or the
+//'  adaptive procedure stopped before num_permutations, possibly at the last
+//'  permutation), tail (largest statistics in decreasing order) and bytes
+//'  (bytes of the native buffers of the procedure)
+//'
+// [[Rcpp::export]]
+SEXP wass_permutations(	const NumericVector x,
+						const NumericVector y,
+						const int num_permutations,
+						const double value_sq=NA_REAL,
+						const int tail_size=0,
+						const int threads=1,
+						const int max_exceedances=0,
+						const double alpha=NA_REAL,
+						const Nullable<List> labels=R_NilValue)
+{
+	if (x.size() == 0 || y.size() == 0) {
+		stop("wass_permutations: Vectors can't be empty");
+	}
+	if (num_permutations < 0) {
+		stop("wass_permutations: num_permutations must not be negative");
+	}
+
+	unique_ptr<label_sets> shared;
+	if (labels.isNotNull()) {
+		shared.reset(new label_sets(labels.get()));
+		if (shared->n_x != (int) x.size() || shared->n != (int) (x.size() + y.size())) {
+			stop("wass_permutations: Label sets don't match the sample sizes");
+		}
+		if (shared->count < num_permutations) {
+			stop("wass_permutations: Fewer label sets than permutations");
+		}
+	}
+	permutation_engine engine(x, y, shared ? 0 : draw_seed(), threads,
+							  shared.get());
+
+	if (tail_size <= 0) {
+		NumericVector statistics(num_permutations);
+		if (num_permutations > 0) {
+			engine.evaluate(0, num_permutations, &statistics[0]);
+		}
+		return statistics;
+	}
+
+	// only the tail is kept: evaluate in blocks to bound the memory.
+	// In sequential and adaptive mode the blocks start small and grow, so
+	// that clearly null samples stop after a few hundred permutations. The
+	// statistics are scanned in permutation order and the block sizes are
+	// fixed, so the stopping point does not depend on the number of threads.
+	const bool 		adaptive = !ISNAN(alpha) && !ISNAN(value_sq),
+					sequential = (max_exceedances > 0) || adaptive;
+	const int 		MAX_BLOCK_SIZE = 16384;
+	int 			block_size = sequential ? 256 : MAX_BLOCK_SIZE;
+	vector<double> 	block(min(num_permutations, MAX_BLOCK_SIZE));
+	permutation_tail tail(tail_size);
+	int 			num_extr = 0,
+					num_perm = 0;
+	bool 			stopped = false;
+
+	for (int first=0; first<num_permutations && !stopped; first=num_perm) {
+		int last = min(first + block_size, num_permutations);
+		engine.evaluate(first, last, block.data());
+		for (int i=0; i<last-first && !stopped; i++) {
+			tail.push(block[i]);
+			if (block[i] >= value_sq) {
+				++num_extr;
+			}
+			++num_perm;
+			stopped = (max_exceedances > 0) && (num_extr >= max_exceedances);
+		}
+		if (adaptive && !stopped && num_perm < num_permutations) {
+			stopped = !wilson_straddles(num_extr, num_perm, alpha);
+		}
+		block_size = min(2 * block_size, MAX_BLOCK_SIZE);
+		checkUserInterrupt();
+	}
+
+	const double bytes = engine.bytes() + tail.bytes()
+						 + block.capacity() * sizeof(double);
+	vector<double> tail_values = tail.decreasing();
+	return Rcpp::List::create(
+		Rcpp::Named("num.extr") = ISNAN(value_sq) ? NA_INTEGER : num_extr,
+		Rcpp::Named("num.perm") = num_perm,
+		Rcpp::Named("stopped") = stopped,
+		Rcpp::Named("tail") = NumericVector(tail_values.begin(),
+											tail_values.end()),
+		Rcpp::Named("bytes") = bytes
+		);
+}
+
+
+//' Shared label sets for the permutation procedure
+//'
+//' Draws the group assignments of num_permutations permutations of a
+//' pooled sample of n_x + n_y values once, so that they can be applied to
+//' the sorted pools of many samples with the same group sizes, e.g. all
+//' genes of a one-stage test in wasserstein.sc. Each label set is stored
+//' as a bitset of n_x + n_y bits, padded to 64 bit words, so that the
+//' sets take (n_x + n_y) / 8 bytes per permutation. Label set i is drawn
+//' like permutation i of wass_permutations, from a stream of the
+//' counter-based generator seeded from R's random number generator.
+//'
+//' @param n_x size of the first group
+//' @param n_y size of the second group
+//' @param num_permutations number of label sets
+//' @return a list with the group sizes n.x and n.y and the label sets as
+//'  raw vector bits, in which bit k of set i is set if position k of the
+//'  sorted pool belongs to the first group
+//'
+// [[Rcpp::export]]
+List permutation_labels(const int n_x,
+						const int n_y,
+						const int num_permutations)
+{
+	if (n_x <= 0 || n_y <= 0) {
+		stop("permutation_labels: Group sizes must be positive");
+	}
+	if (num_permutations < 0) {
+		stop("permutation_labels: num_permutations must not be negative");
+	}
+
+	const int 		n = n_x + n_y,
+					n_draw = min(n_x, n_y),
+					words = (n + 63) / 64;
+	const uint64_t 	seed = draw_seed();
+	RawVector 		bits((size_t) num_permutations * words * 8);
+	vector<uint64_t> set(words);
+
+	for (int perm=0; perm<num_permutations; perm++) {
+		// Floyd's algorithm as in permutation_sampler, on the smaller group
+		counter_rng rng(seed, perm);
+		fill(set.begin(), set.end(), 0);
+		for (int j=n-n_draw; j<n; j++) {
+			int t = rng.index((uint32_t) (j + 1));
+			if ((set[t / 64] >> (t % 64)) & 1) {
+				t = j;
+			}
+			set[t / 64] |= 1ULL << (t % 64);
+		}
+		if (n_draw != n_x) {
+			// the drawn positions belong to y
+			for (int w=0; w<words; w++) {
+				set[w] = ~set[w];
+			}
+			if (n % 64 != 0) {
+				set[words - 1] &= ~0ULL >> (64 - n % 64);
+			}
+		}
+		memcpy(bits.begin() + (size_t) perm * words * 8, set.data(),
+			   words * 8);
+	}
+
+	return List::create(
+		Named("n.x") = n_x,
+		Named("n.y") = n_y,
+		Named("bits") = bits);
+}
+
+
+/*=============================================
+
+			QUANTILE SKETCHES
+
+==============================================*/
+
+// squared_wass_decomp and squared_wass_approx only use the mean, the
+// standard deviation and the NUM_QUANTILES quantiles of a sample. For
+// samples too large to be sorted in memory, the quantiles can come from a
+// KLL sketch (Karnin, Lang and Liberty, 2016) instead: a hierarchy of
+// compactors, in which level h holds values that stand for 2^h values of
+// the sample. A full level is sorted and every second of its values is
+// promoted to the next level, starting at a random offset, so that the
+// rank of any value is estimated without bias. The sketch reads a sample
+// in one pass, in memory that depends on the rank error only, and the
+// sketches of chunks of a sample merge into a sketch of the whole sample.
+// Mean and standard deviation are accumulated exactly.
+
+const int 		SKETCH_MIN_CAPACITY = 8,
+				SKETCH_MAX_K = 65536;
+const uint64_t 	SKETCH_SEED = 0x5EEDCAFEULL;
+
+//' quantile_sketch
+//'
+//' KLL sketch of a sample with the exact moments of the sample. Level h
+//' holds values of weight 2^h; the capacity of a level is k for the top
+//' level and shrinks by a factor of 2/3 per level below it.
+//'
+struct quantile_sketch
+{
+	int 					k;
+	uint64_t 				n = 0,
+							stream,
+							compactions = 0;
+	vector<vector<double>> 	levels;
+	size_t 					size = 0,
+							limit = 0;
+	moment_accumulator 		moments;
+
+	// stream selects the random offsets of the compactions, so that
+	// sketches of different chunks compact independently
+	quantile_sketch(const int k, const uint64_t stream)
+		: k(k), stream(stream), levels(1)
+	{
+		limit = total_capacity();
+	}
+
+	// k with a normalized rank error below epsilon with probability 0.99,
+	// by the empirical bound 2.296 / k^0.9723 of the KLL sketches of
+	// Apache DataSketches
+	static int k_for(const double epsilon)
+	{
+		const double k = ceil(pow(2.296 / epsilon, 1 / 0.9723));
+		return (int) min(max(k, (double) SKETCH_MIN_CAPACITY),
+						 (double) SKETCH_MAX_K);
+	}
+
+	int capacity(const size_t h) const
+	{
+		const double depth = levels.size() - 1 - h;
+		return max(SKETCH_MIN_CAPACITY, (int) ceil(k * pow(2.0 / 3.0, depth)));
+	}
+
+	size_t total_capacity() const
+	{
+		size_t total = 0;
+		for (size_t h=0; h<levels.size(); h++) {
+			total += capacity(h);
+		}
+		return total;
+	}
+
+	void add(const double x)
+	{
+		levels[0].push_back(x);
+		++n;
+		++size;
+		moments.add(x);
+		if (size >= limit) {
+			compress();
+		}
+	}
+
+	// adds the values of other; the merged sketch keeps the smaller k
+	void merge(const quantile_sketch & other)
+	{
+		k = min(k, other.k);
+		if (levels.size() < other.levels.size()) {
+			levels.resize(other.levels.size());
+		}
+		for (size_t h=0; h<other.levels.size(); h++) {
+			levels[h].insert(levels[h].end(), other.levels[h].begin(),
+							 other.levels[h].end());
+		}
+		n += other.n;
+		size += other.size;
+		moments.merge(other.moments);
+		compress();
+	}
+
+	// compacts all full levels, from the bottom up
+	void compress()
+	{
+		for (size_t h=0; h<levels.size(); h++) {
+			if ((int) levels[h].size() >= capacity(h)) {
+				compact(h);
+			}
+		}
+		limit = total_capacity();
+	}
+
+	// sorts level h and promotes every second of its values to level h+1;
+	// of an odd number of values, the largest stays at level h
+	void compact(const size_t h)
+	{
+		if (h + 1 == levels.size()) {
+			levels.emplace_back();
+		}
+		vector<double> 	&level = levels[h],
+						&next = levels[h + 1];
+		sort(level.begin(), level.end());
+
+		const size_t pairs = level.size() / 2,
+					 offset = counter_rng(SKETCH_SEED + stream,
+										  compactions++).next() & 1;
+		for (size_t i=0; i<pairs; i++) {
+			next.push_back(level[2 * i + offset]);
+		}
+		level.erase(level.begin(), level.begin() + 2 * pairs);
+		size -= pairs;
+	}
+
+	// type-1 quantiles at the given increasing levels: the smallest value
+	// whose estimated rank is at least n * prob; exact while no level has
+	// been compacted
+	vector<double> quantiles(const vector<double> & probs) const
+	{
+		vector<pair<double, uint64_t>> weighted;
+		weighted.reserve(size);
+		for (size_t h=0; h<levels.size(); h++) {
+			for (const double value : levels[h]) {
+				weighted.push_back(make_pair(value, (uint64_t) 1 << h));
+			}
+		}
+		sort(weighted.begin(), weighted.end());
+
+		vector<double> 	q(probs.size());
+		uint64_t 		rank = weighted[0].second;
+		size_t 			i = 0;
+		for (size_t j=0; j<probs.size(); j++) {
+			const double target = probs[j] * (double) n;
+			while (i + 1 < weighted.size() && (double) rank < target) {
+				rank += weighted[++i].second;
+			}
+			q[j] = weighted[i].first;
+		}
+		return q;
+	}
+
+	// prepared sample with the moments and the quantiles of the sketch
+	prepared_sample summary() const
+	{
+		prepared_sample s;
+		s.mean = moments.mean;
+		s.sd = moments.sd();
+		vector<double> probs(NUM_QUANTILES);
+		for (int j=0; j<NUM_QUANTILES; j++) {
+			probs[j] = (j + 1 - 0.5) / NUM_QUANTILES;
+		}
+		s.quantiles = quantiles(probs);
+		return s;
+	}
+};
+
+
+//' quantile_sketch_from
+//'
+//' @param x handle returned by sketch_sample or merge_sketches
+//' @param fn name of the calling function for error messages
+//' @return the sketch of the handle
+//'
+const quantile_sketch & quantile_sketch_from(SEXP x, const string & fn)
+{
+	if (!is_quantile_sketch(x)) {
+		stop(fn + ": Expected a handle returned by sketch_sample");
+	}
+	XPtr<quantile_sketch> handle(x);
+	if (handle.get() == nullptr) {
+		// external pointers are not saved with the workspace
+		stop("Quantile sketch is no longer valid, call sketch_sample again");
+	}
+	return *handle;
+}
+
+
+const prepared_sample & prepared_summary_from(SEXP x, prepared_sample & scratch)
+{
+	if (is_quantile_sketch(x)) {
+		scratch = quantile_sketch_from(x, "prepared_summary_from").summary();
+		return scratch;
+	}
+	if (is_prepared_sample(x)) {
+		return prepared_sample_from(x, scratch);
+	}
+	const NumericVector values(x);
+	vector<double> copy(values.begin(), values.end());
+	scratch = prepared_summary_of(copy);
+	return scratch;
+}
+
+
+//' Sketch the quantiles of a large sample
+//'
+//' Reads a sample in one pass into a quantile sketch (KLL sketch) of bounded
+//' size, together with the exact mean and standard deviation of the sample.
+//' The returned handle can be passed in place of the sample to
+//' \code{squared_wass_decomp} and \code{squared_wass_approx}, which then
+//' compute their results from the quantiles of the sketch. Each of these
+//' quantiles has a normalized rank error below \code{epsilon} with
+//' probability 0.99: the quantile at level \eqn{p} is a value of the sample
+//' whose rank lies between \eqn{n(p-\epsilon)} and \eqn{n(p+\epsilon)}.
+//' Samples with fewer values than the capacity of the sketch, about
+//' \eqn{2.9/\epsilon} (2863 for the default), are sketched exactly, so that
+//' the results are the same as with the samples themselves.
+//'
+//' The sketch takes memory independent of the sample size, a few tens of
+//' kilobytes for the default \code{epsilon}. A sample too large for memory
+//' can be sketched chunk by chunk and the sketches of the chunks combined
+//' by \code{merge_sketches}. With \code{threads} > 1, the sample is split
+//' into as many chunks that are sketched in parallel.
+//'
+//' Compactions of the sketch keep every second of its values, starting at a
+//' pseudo-random offset drawn from a fixed seed, so that the sketch of a
+//' sample is reproducible for the same chunks and number of threads and does
+//' not use the random number generator of R. The handle is an external
+//' pointer and is not saved with the workspace. As the sketch does not hold
+//' the sorted sample, it cannot be passed to \code{wasserstein_metric}.
+//'
+//' @param x sample (vector)
+//' @param epsilon normalized rank error of the quantiles, in (0, 1)
+//' @param threads number of native threads
+//' @return a handle of class \code{quantile_sketch}
+//'
+//' @seealso \code{\link{merge_sketches}}, \code{\link{squared_wass_decomp}},
+//' \code{\link{squared_wass_approx}}, \code{\link{prepare_sample}}
+//'
+//' @examples
+//' set.seed(24)
+//' x<-rnorm(1e5)
+//' y<-rnorm(1e5, mean=0.5, sd=2)
+//' squared_wass_decomp(sketch_sample(x),sketch_sample(y))
+//'
+//' #sketch y in two chunks
+//' sy<-merge_sketches(sketch_sample(y[1:50000]),
+//'                    sketch_sample(y[50001:1e5]))
+//' squared_wass_approx(sketch_sample(x),sy)
+//'
+//' @export
+//[[Rcpp::export]]
+SEXP sketch_sample(const NumericVector x, const double epsilon=0.001,
+				   const int threads=1)
+{
+	if (x.size() == 0) {
+		stop("sketch_sample: Vector can't be empty");
+	}
+	if (!(epsilon > 0 && epsilon < 1)) {
+		stop("sketch_sample: epsilon has to be in (0, 1)");
+	}
+
+	const int 		k = quantile_sketch::k_for(epsilon);
+	const size_t 	n = x.size();
+	const int 		n_threads = (int) max((size_t) 1,
+										  min((size_t) max(threads, 1), n / k));
+	const double 	*values = x.begin();
+	vector<quantile_sketch> sketches(n_threads, quantile_sketch(k, 0));
+
+	auto run_block = [&](const int t) {
+		const size_t 	first = n * t / n_threads,
+						last = n * (t+1) / n_threads;
+		sketches[t].stream = t;
+		for (size_t i=first; i<last; i++) {
+			sketches[t].add(values[i]);
+		}
+	};
+
+	vector<thread> workers;
+	for (int t=1; t<n_threads; t++) {
+		try {
+			workers.push_back(thread(run_block, t));
+		} catch (const system_error &) {
+			// no more threads available: sketch the block here
+			run_block(t);
+		}
+	}
+	run_block(0);
+	for (thread & worker : workers) {
+		worker.join();
+	}
+
+	XPtr<quantile_sketch> handle(new quantile_sketch(sketches[0]), true);
+	for (int t=1; t<n_threads; t++) {
+		handle->merge(sketches[t]);
+	}
+	handle.attr("class") = "quantile_sketch";
+	return handle;
+}
+
+
+//' Merge quantile sketches
+//'
+//' Combines the sketches of two samples into a sketch of the concatenated
+//' samples, e.g. of two chunks of a sample that does not fit into memory.
+//' The merged sketch has the larger rank error of the two. Neither input is
+//' modified.
+//'
+//' @param x handle returned by \code{sketch_sample} or \code{merge_sketches}
+//' @param y handle returned by \code{sketch_sample} or \code{merge_sketches}
+//' @return a handle of class \code{quantile_sketch}
+//'
+//' @seealso \code{\link{sketch_sample}}
+//'
+//' @examples
+//' set.seed(24)
+//' chunks<-lapply(1:4, function(i) rnorm(1e4))
+//' sx<-Reduce(merge_sketches, lapply(chunks, sketch_sample))
+//' squared_wass_decomp(sx,rnorm(1e3))$distance
+//'
+//' @export
+//[[Rcpp::export]]
+SEXP merge_sketches(SEXP x, SEXP y)
+{
+	const quantile_sketch 	&a = quantile_sketch_from(x, "merge_sketches"),
+							&b = quantile_sketch_from(y, "merge_sketches");
+	XPtr<quantile_sketch> handle(new quantile_sketch(a), true);
+	handle->merge(b);
+	handle.attr("class") = "quantile_sketch";
+	return handle;
 }
 
 
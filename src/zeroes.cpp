@@ -0,0 +1,364 @@
+// [[Rcpp::depends(RcppArmadillo)]]
+
+#include <cfloat>
+#include <system_error>
+#include <thread>
+#include <RcppArmadillo.h>
+
+using namespace std;
+using namespace Rcpp;
+
+
+
+/*=============================================
+
+		DIFFERENTIAL PROPORTIONS OF ZERO EXPRESSION
+
+==============================================*/
+
+// testZeroes fits, for every gene, the Bayesian logistic regression of the
+// non-zero indicator on the cellular detection rate and the condition that
+// arm::bayesglm fits with its default priors: independent Cauchy priors with
+// scale 10 on the intercept and 2.5 on the (scaled) coefficients, fitted by
+// iteratively reweighted least squares in which the prior scales are updated
+// by the EM step for the Student-t prior. The design matrix is the same for
+// all genes and only the response changes, so each IRLS step accumulates and
+// solves the 3 x 3 normal equations of one gene.
+
+
+//' logistic_design
+//'
+//' Design shared by the models of all genes: intercept, detection rate and
+//' indicator of the second condition for every cell, with the prior scales
+//' of bayesglm (scaled = TRUE) and the row of the augmented least squares
+//' problem that carries the prior of the intercept (the column means).
+//'
+struct logistic_design
+{
+	int 			n;
+	vector<double> 	detection,
+					condition;
+	double 			prior_scale[3],
+					center[3];
+
+	logistic_design(const NumericVector & detection_,
+					const IntegerVector & group)
+		: n(detection_.size()),
+		  detection(detection_.begin(), detection_.end()),
+		  condition(n)
+	{
+		for (int i=0; i<n; i++) {
+			condition[i] = (group[i] == 2) ? 1.0 : 0.0;
+		}
+		prior_scale[0] = 10.0;
+		prior_scale[1] = 2.5 / predictor_scale(detection);
+		prior_scale[2] = 2.5 / predictor_scale(condition);
+
+		center[0] = 1.0;
+		center[1] = center[2] = 0.0;
+		for (int i=0; i<n; i++) {
+			center[1] += detection[i];
+			center[2] += condition[i];
+		}
+		center[1] /= n;
+		center[2] /= n;
+	}
+
+	// scale of a predictor in bayesglm: the range of binary predictors,
+	// twice the standard deviation of all others
+	static double predictor_scale(const vector<double> & x)
+	{
+		vector<double> sorted(x);
+		sort(sorted.begin(), sorted.end());
+		const int categories = unique(sorted.begin(), sorted.end())
+							   - sorted.begin();
+		if (categories < 2) {
+			return 1.0;
+		}
+		if (categories == 2) {
+			return sorted[1] - sorted[0];
+		}
+
+		double mean = 0, sq = 0;
+		for (double v : x) {
+			mean += v;
+		}
+		mean /= x.size();
+		for (double v : x) {
+			sq += (v - mean) * (v - mean);
+		}
+		return 2 * sqrt(sq / (x.size() - 1));
+	}
+};
+
+
+//' logistic_fit
+//'
+//' Fits the model of one gene to its non-zero indicator y, as bayesglm does:
+//' the starting values, the convergence criterion on the deviance (relative
+//' change below 1e-8, at most 100 iterations) and the clamping of the
+//' logistic link at |eta| = 30 are those of glm. The standard errors come
+//' from the normal equations of the last iteration, including the prior.
+//'
+//' @param design shared design
+//' @param y non-zero indicator of every cell
+//' @param coef estimated coefficients
+//' @param se standard errors of the coefficients
+//'
+void logistic_fit(const logistic_design & design, const vector<char> & y,
+				  double coef[3], double se[3])
+{
+	const int 		n = design.n;
+	const double 	*d = design.detection.data(),
+					*c = design.condition.data();
+
+	// logistic link of glm (binomial()$linkinv and $mu.eta)
+	auto inverse = [](const double eta) {
+		const double t = (eta < -30) ? DBL_EPSILON
+						 : (eta > 30) ? 1 / DBL_EPSILON : exp(eta);
+		return t / (1 + t);
+	};
+	auto derivative = [](const double eta) {
+		if (eta < -30 || eta > 30) {
+			return DBL_EPSILON;
+		}
+		const double e = exp(eta);
+		return e / ((1 + e) * (1 + e));
+	};
+	// linear predictor of cell i; glm starts from mu = (y + 0.5) / 2
+	auto linear = [&](const int i, const bool start) {
+		return start ? (y[i] ? log(3.0) : -log(3.0))
+					 : coef[0] + coef[1] * d[i] + coef[2] * c[i];
+	};
+	auto deviance = [&](const bool start) {
+		double dev = 0;
+		for (int i=0; i<n; i++) {
+			const double mu = inverse(linear(i, start));
+			dev -= 2 * log(y[i] ? mu : 1 - mu);
+		}
+		return dev;
+	};
+
+	double 	prior_sd[3],
+			inv[3][3] = {{0}},
+			devold = deviance(true);
+	for (int j=0; j<3; j++) {
+		prior_sd[j] = design.prior_scale[j];
+	}
+
+	for (int iter=0; iter<100; iter++) {
+		// normal equations of the weighted least squares problem, augmented
+		// by one row per prior (the intercept prior on the column means)
+		double a[6] = {0}, b[3] = {0};
+		for (int i=0; i<n; i++) {
+			const double 	eta = linear(i, iter == 0),
+							mu = inverse(eta),
+							mu_eta = derivative(eta),
+							w = mu_eta * mu_eta / (mu * (1 - mu)),
+							wz = w * (eta + (y[i] - mu) / mu_eta);
+			a[0] += w;
+			a[1] += w * d[i];
+			a[2] += w * c[i];
+			a[3] += w * d[i] * d[i];
+			a[4] += w * d[i] * c[i];
+			a[5] += w * c[i] * c[i];
+			b[0] += wz;
+			b[1] += wz * d[i];
+			b[2] += wz * c[i];
+		}
+		const double 	*r = design.center,
+						p0 = 1 / (prior_sd[0] * prior_sd[0]);
+		a[0] += p0 * r[0] * r[0];
+		a[1] += p0 * r[0] * r[1];
+		a[2] += p0 * r[0] * r[2];
+		a[3] += p0 * r[1] * r[1] + 1 / (prior_sd[1] * prior_sd[1]);
+		a[4] += p0 * r[1] * r[2];
+		a[5] += p0 * r[2] * r[2] + 1 / (prior_sd[2] * prior_sd[2]);
+
+		// inverse of the symmetric 3 x 3 matrix by cofactors
+		const double 	m[3][3] = {{a[0], a[1], a[2]},
+								   {a[1], a[3], a[4]},
+								   {a[2], a[4], a[5]}};
+		for (int i=0; i<3; i++) {
+			for (int j=0; j<3; j++) {
+				const int 	i1 = (j + 1) % 3, i2 = (j + 2) % 3,
+							j1 = (i + 1) % 3, j2 = (i + 2) % 3;
+				inv[i][j] = m[i1][j1] * m[i2][j2] - m[i1][j2] * m[i2][j1];
+			}
+		}
+		const double det = m[0][0] * inv[0][0] + m[0][1] * inv[1][0]
+						   + m[0][2] * inv[2][0];
+		for (int i=0; i<3; i++) {
+			for (int j=0; j<3; j++) {
+				inv[i][j] /= det;
+			}
+		}
+		for (int j=0; j<3; j++) {
+			coef[j] = inv[j][0] * b[0] + inv[j][1] * b[1] + inv[j][2] * b[2];
+		}
+
+		// EM update of the prior scales of the Cauchy priors (df = 1)
+		const double dev = deviance(false);
+		for (int j=0; j<3; j++) {
+			const double s = design.prior_scale[j];
+			prior_sd[j] = sqrt((coef[j] * coef[j] + inv[j][j] + s * s) / 2);
+		}
+		if (fabs(dev - devold) / (fabs(dev) + 0.1) < 1e-8) {
+			break;
+		}
+		devold = dev;
+	}
+
+	for (int j=0; j<3; j++) {
+		se[j] = sqrt(inv[j][j]);
+	}
+}
+
+
+//' logistic_zero_rows
+//'
+//' Fits the models of the given genes on up to \code{threads} native
+//' threads and returns the two-sided p-values of the condition coefficient.
+//' Genes without zeros get NA. The non-zero indicator of a gene is filled
+//' by \code{indicator(row, y)}, which returns whether the row has a zero.
+//'
+template <typename Indicator>
+NumericVector logistic_zero_rows(const logistic_design & design,
+								 const IntegerVector & rows,
+								 const int threads,
+								 const Indicator & indicator)
+{
+	const int 		count = rows.size(),
+					n_threads = max(1, min(threads, count));
+	vector<int> 	index(rows.begin(), rows.end());
+	vector<double> 	pval(count);
+
+	auto run_block = [&](const int t) {
+		const int 	first = (int) ((int64_t) count * t / n_threads),
+					last = (int) ((int64_t) count * (t+1) / n_threads);
+		vector<char> y(design.n);
+		double coef[3], se[3];
+		for (int k=first; k<last; k++) {
+			if (!indicator(index[k], y)) {
+				pval[k] = NA_REAL;
+				continue;
+			}
+			logistic_fit(design, y, coef, se);
+			pval[k] = erfc(fabs(coef[2] / se[2]) / sqrt(2.0));
+		}
+	};
+
+	vector<thread> workers;
+	for (int t=1; t<n_threads; t++) {
+		try {
+			workers.push_back(thread(run_block, t));
+		} catch (const system_error &) {
+			// no more threads available: fit the block here
+			run_block(t);
+		}
+	}
+	run_block(0);
+	for (thread & worker : workers) {
+		worker.join();
+	}
+
+	return NumericVector(pval.begin(), pval.end());
+}
+
+
+//' Test for differential proportions of zero expression in a sparse matrix
+//'
+//' Native counterpart of fitting
+//' \code{bayesglm(trow > 0 ~ detection + factor(cond), family=binomial)}
+//' for every requested row of a matrix in compressed sparse row layout and
+//' taking the p-value of the condition coefficient. The non-zero
+//' indicator of a row is built from its stored entries.
+//'
+//' @param csr a list as returned by sparse_csr, genes in rows
+//' @param detection cellular detection rate of every column
+//' @param group condition (1 or 2) of every column
+//' @param rows 1-based indices of the rows to test
+//' @param threads number of native threads
+//' @return vector of p-values, NA for rows without zeros
+//'
+// [[Rcpp::export]]
+NumericVector logistic_zero_test(const List csr,
+								 const NumericVector detection,
+								 const IntegerVector group,
+								 const IntegerVector rows,
+								 const int threads=1)
+{
+	const IntegerVector 	dim = csr["Dim"],
+							row_p = csr["p"],
+							col_j = csr["j"];
+	const NumericVector 	row_x = csr["x"];
+
+	if (detection.size() != dim[1] || group.size() != dim[1]) {
+		stop("logistic_zero_test: detection and group need one value per column");
+	}
+	for (int r : rows) {
+		if (r < 1 || r > dim[0]) {
+			stop("logistic_zero_test: Row index out of bounds");
+		}
+	}
+
+	const logistic_design design(detection, group);
+	const int 	*p = row_p.begin(),
+				*j = col_j.begin();
+	const double *x = row_x.begin();
+	return logistic_zero_rows(design, rows, threads,
+		[&](const int row, vector<char> & y) {
+			fill(y.begin(), y.end(), 0);
+			int nonzero = 0;
+			for (int k=p[row - 1]; k<p[row]; k++) {
+				y[j[k]] = (x[k] > 0);
+				nonzero += (x[k] != 0);
+			}
+			return nonzero < (int) y.size();
+		});
+}
+
+
+//' Test for differential proportions of zero expression in a dense matrix
+//'
+//' Same as logistic_zero_test for a dense matrix with genes in rows.
+//'
+//' @param m matrix with genes in rows and cells in columns
+//' @param detection cellular detection rate of every column
+//' @param group condition (1 or 2) of every column
+//' @param rows 1-based indices of the rows to test
+//' @param threads number of native threads
+//' @return vector of p-values, NA for rows without zeros
+//'
+// [[Rcpp::export]]
+NumericVector logistic_zero_test_dense(const NumericMatrix m,
+									   const NumericVector detection,
+									   const IntegerVector group,
+									   const IntegerVector rows,
+									   const int threads=1)
+{
+	const int 	nrow = m.nrow(),
+				ncol = m.ncol();
+
+	if (detection.size() != ncol || group.size() != ncol) {
+		stop("logistic_zero_test_dense: detection and group need one value per column");
+	}
+	for (int r : rows) {
+		if (r < 1 || r > nrow) {
+			stop("logistic_zero_test_dense: Row index out of bounds");
+		}
+	}
+
+	const logistic_design design(detection, group);
+	const double *x = m.begin();
+	return logistic_zero_rows(design, rows, threads,
+		[&](const int row, vector<char> & y) {
+			bool zero = false;
+			for (int c=0; c<ncol; c++) {
+				const double v = x[(size_t) c * nrow + row - 1];
+				y[c] = (v > 0);
+				zero = zero || (v == 0);
+			}
+			return zero;
+		});
+}
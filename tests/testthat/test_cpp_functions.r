@@ -107,6 +107,180 @@ test_that("permutations", {
   ))
 })
 
+#### NATIVE PERMUTATION PROCEDURE
+test_that("wass_permutations", {
+  skip_if_not_exported()
+  set.seed(42)
+  x <- rnorm(40)
+  y <- rnorm(55, 1)
+  value.sq <- wasserstein_metric(x, y, p=2)**2
+
+  set.seed(24)
+  stats <- wass_permutations(x, y, 500)
+  expect_length(stats, 500)
+  expect_true(all(stats >= 0))
+
+  # the tail mode draws the same permutations as the full mode
+  set.seed(24)
+  res <- wass_permutations(x, y, 500, value_sq=value.sq, tail_size=251)
+  expect_equal(res$num.extr, sum(stats >= value.sq))
+  expect_equal(res$tail, sort(stats, decreasing=TRUE)[seq_len(251)])
+
+  # the pooled sample is sorted once, so the order of the input is irrelevant
+  set.seed(24)
+  stats.shuffled <- wass_permutations(rev(x), sample(y), 500)
+  set.seed(24)
+  expect_equal(wass_permutations(x, y, 500), stats.shuffled)
+
+  # permutation i always uses the same random stream, whatever the threads
+  set.seed(24)
+  stats.threaded <- wass_permutations(x, y, 500, threads=3)
+  expect_identical(stats, stats.threaded)
+
+  # sequential mode stops at the permutation with the h-th exceedance
+  set.seed(24)
+  res.seq <- wass_permutations(x, y, 500, value_sq=median(stats),
+                               tail_size=251, max_exceedances=10)
+  expect_equal(res.seq$num.extr, 10)
+  expect_equal(res.seq$num.perm,
+               which(cumsum(stats >= median(stats)) == 10)[1])
+  expect_true(res.seq$stopped)
+
+  # the h-th exceedance at the last permutation stops the procedure as well
+  last <- res.seq$num.perm
+  set.seed(24)
+  res.last <- wass_permutations(x, y, last, value_sq=median(stats),
+                                tail_size=251, max_exceedances=10)
+  expect_equal(res.last$num.perm, last)
+  expect_true(res.last$stopped)
+  set.seed(24)
+  res.short <- wass_permutations(x, y, last - 1, value_sq=median(stats),
+                                 tail_size=251, max_exceedances=10)
+  expect_equal(res.short$num.extr, 9)
+  expect_false(res.short$stopped)
+
+  # adaptive mode stops at the end of the first block (256 permutations),
+  # since a p-value of about 0.5 is clearly above alpha
+  set.seed(24)
+  res.ada <- wass_permutations(x, y, 500, value_sq=median(stats),
+                               tail_size=251, alpha=0.05)
+  expect_equal(res.ada$num.perm, 256)
+  expect_equal(res.ada$num.extr, sum(stats[1:256] >= median(stats)))
+  # without exceedances, all permutations are left to the GPD approximation
+  set.seed(24)
+  res.ada <- wass_permutations(x, y, 500, value_sq=max(stats) + 1,
+                               tail_size=251, alpha=0.05)
+  expect_equal(res.ada$num.perm, 500)
+
+  # zero-inflated samples are permuted with the zeros as one atom
+  x0 <- c(rep(0, 60), rpois(20, 3))
+  y0 <- c(rep(0, 40), rpois(25, 1))
+  set.seed(24)
+  stats0 <- wass_permutations(x0, y0, 500)
+  set.seed(24)
+  expect_identical(wass_permutations(x0, y0, 500, threads=3), stats0)
+  set.seed(24)
+  res0 <- wass_permutations(x0, y0, 500, value_sq=median(stats0),
+                            tail_size=251)
+  expect_equal(res0$num.extr, sum(stats0 >= median(stats0)))
+  expect_equal(res0$tail, sort(stats0, decreasing=TRUE)[seq_len(251)])
+  # the pool and one buffer per group at least
+  expect_true(res0$bytes >= 8 * (length(x0) + length(y0)))
+  expect_true(all(stats0 >= 0))
+  expect_true(all(wass_permutations(rep(0, 10), rep(0, 5), 20) == 0))
+
+  # permutations of constant samples have distance 0
+  expect_true(all(wass_permutations(rep(1, 10), rep(1, 5), 20) == 0))
+  expect_error(wass_permutations(c(), c(1, 2), 10))
+})
+
+test_that("permutation_labels", {
+  skip_if_not_exported()
+  set.seed(42)
+  x <- rnorm(40)
+  y <- rnorm(55, 1)
+
+  # one bitset of 95 bits, padded to two 64 bit words, per permutation
+  set.seed(24)
+  labels <- permutation_labels(40, 55, 500)
+  expect_length(labels$bits, 500 * 16)
+  bits <- matrix(as.integer(rawToBits(labels$bits)), nrow=128)
+  expect_true(all(colSums(bits[1:95, ]) == 40))
+  expect_true(all(bits[96:128, ] == 0))
+
+  # label set i is drawn like permutation i from the same seed
+  set.seed(24)
+  stats <- wass_permutations(x, y, 500)
+  expect_identical(wass_permutations(x, y, 500, labels=labels), stats)
+  set.seed(24)
+  expect_identical(wass_permutations(x, y, 500, labels=labels, threads=3),
+                   stats)
+
+  # zero-inflated pools only count the zeros of each label set
+  x0 <- c(rep(0, 30), rpois(10, 3))
+  y0 <- c(rep(0, 40), rpois(15, 1))
+  stats0 <- wass_permutations(x0, y0, 500, labels=labels)
+  expect_true(all(stats0 >= 0))
+  value.sq <- median(stats0)
+  res0 <- wass_permutations(x0, y0, 500, value_sq=value.sq, tail_size=251,
+                            labels=labels)
+  expect_equal(res0$num.extr, sum(stats0 >= value.sq))
+
+  expect_error(wass_permutations(x, y[-1], 10, labels=labels))
+  expect_error(wass_permutations(x, y, 501, labels=labels))
+  expect_error(permutation_labels(0, 5, 10))
+})
+
+#### DIFFERENTIAL PROPORTIONS OF ZERO EXPRESSION
+test_that("logistic_zero_test", {
+  skip_if_not_exported()
+  set.seed(24)
+  dense <- matrix(rnbinom(10*40, 1, 0.5), nrow=10)
+  dense[4, ] <- 1
+  m <- Matrix::Matrix(dense, sparse=TRUE)
+  detection <- colSums(dense > 0) / nrow(dense)
+  group <- rep(c(1L, 2L), each=20)
+
+  pval <- logistic_zero_test_dense(dense, detection, group, 1:10)
+  expect_length(pval, 10)
+  expect_true(is.na(pval[4]))
+  expect_true(all(pval[-4] > 0 & pval[-4] <= 1))
+  expect_equal(logistic_zero_test(sparse_csr(m), detection, group, 1:10),
+               pval)
+  # the fits don't depend on the number of threads or the order of the rows
+  expect_identical(logistic_zero_test_dense(dense, detection, group, 10:1,
+                                            threads=3), rev(pval))
+  expect_error(logistic_zero_test_dense(dense, detection, group, 11))
+  expect_error(logistic_zero_test(sparse_csr(m), detection[-1], group, 1))
+})
+
+#### SPARSE EXPRESSION MATRICES
+test_that("sparse_csr", {
+  skip_if_not_exported()
+  dense <- matrix(c(0, 1.5, 0, 2,
+                    0, 0, 0, 0,
+                    3, 0, 0.5, 0), nrow=3, byrow=TRUE)
+  m <- Matrix::Matrix(dense, sparse=TRUE)
+  group <- c(1, 2, 2, 1)
+
+  csr <- sparse_csr(m)
+  expect_equal(csr$p, c(0, 2, 2, 4))
+  expect_equal(csr$j, c(1, 3, 0, 2))
+  expect_equal(csr$x, c(1.5, 2, 3, 0.5))
+  for (i in seq_len(nrow(dense))) {
+    expect_equal(sparse_row(csr, i), dense[i, ])
+    expect_equal(sparse_row_split(csr, i, group),
+                 list(x1=dense[i, group == 1], x2=dense[i, group == 2]))
+    nonzero <- dense[i, ] > 0
+    expect_equal(sparse_row_split(csr, i, group, inclZero=FALSE),
+                 list(x1=dense[i, group == 1 & nonzero],
+                      x2=dense[i, group == 2 & nonzero]))
+  }
+  expect_equal(sparse_detection(m), colSums(dense > 0) / nrow(dense))
+  expect_error(sparse_row(csr, 4))
+  expect_error(sparse_row_split(csr, 1, c(1, 2)))
+})
+
 #### CUMULATIVE SUM OF NUMERIC VECTOR
 test_that("cumSum_test_export", {
   skip_if_not_exported()
@@ -226,5 +400,151 @@ test_that("quantile_test_export",{
                   quantile(c(1:10), probs=seq(1:5)/5, type=1)))
   expect_true(all(quantile_test_export(c(1:5), seq(1:10)/10) ==
                   quantile(c(1:5), probs=seq(1:10)/10, type=1)))
+  # unsorted samples with ties, unsorted and repeated levels
+  set.seed(24)
+  x <- c(round(rnorm(700), 1), rep(0, 300))
+  probs <- c((seq_len(1000) - 0.5) / 1000, 0.9, 0, 0.3125, 0.3125, 1)
+  expect_identical(quantile_test_export(x, probs),
+                   unname(quantile(x, probs=probs, type=1)))
+  expect_identical(equidist_quantile_test_export(x, 1000, 0.5),
+                   quantile_test_export(x, (seq_len(1000) - 0.5) / 1000))
+})
+
+
+#### fused test statistics
+test_that("wass_statistics", {
+  skip_if_not_exported()
+  set.seed(24)
+  x <- rnorm(300, 1)
+  y <- c(rep(0, 50), rexp(150))
+  stats <- wass_statistics(x, y)
+  expect_equal(names(stats), c("d.wass", "d.wass^2", "d.comp^2", "d.comp",
+                               "location", "size", "shape", "rho",
+                               "perc.loc", "perc.size", "perc.shape",
+                               "decomp.error"))
+  expect_identical(stats[["d.wass"]], wasserstein_metric(x, y, p=2))
+  decomp <- squared_wass_decomp(x, y)
+  expect_identical(stats[["d.comp^2"]], decomp$distance)
+  expect_identical(stats[["shape"]], decomp$shape)
+  expect_equal(stats[["location"]], (mean(x) - mean(y))^2)
+  expect_equal(stats[["size"]], (sd(x) - sd(y))^2)
+  expect_equal(stats[["rho"]], .quantileCorrelation(x, y))
+  expect_equal(stats[["perc.loc"]],
+               round(decomp$location / decomp$distance * 100, 2))
+  expect_equal(stats[["decomp.error"]],
+               .relativeError(decomp$distance, stats[["d.wass^2"]]))
+  expect_equal(wass_statistics(x, y, relative_to_comp=TRUE)[["decomp.error"]],
+               .relativeError(stats[["d.wass^2"]], decomp$distance))
+  # constant quantiles give a correlation of 0
+  expect_equal(wass_statistics(rep(0, 107),
+                               c(rep(0, 154), 0.85, rep(0, 26)))[["rho"]], 0)
+})
+
+#### test statistic of the asymptotic test
+test_that("asy_test_statistic", {
+  skip_if_not_exported()
+  set.seed(24)
+  asy.stat <- function(x, y) {
+    pr <- seq(from=0, to=1, by=1/10000)
+    trf <- (ecdf(y)(quantile(x, probs=pr, type=1)) - pr)^2
+    (length(x) * length(y) / (length(x) + length(y))) * sum(trf) / length(pr)
+  }
+  x <- rnorm(300)
+  y <- rnorm(170, 0.5)
+  z <- rpois(90, 2)
+  expect_equal(asy_test_statistic(x, y), asy.stat(x, y))
+  expect_equal(asy_test_statistic(z, x), asy.stat(z, x))
+  expect_equal(asy_test_statistic(prepare_sample(y), z), asy.stat(y, z))
+  expect_equal(asy_test_statistic(x, x), asy.stat(x, x))
 })
 
+test_that("brownian_bridge_sf", {
+  skip_if_not_exported()
+  # critical values of the limiting Cramer-von Mises distribution
+  crit <- c(0.347, 0.461, 0.743, 1.168)
+  expect_equal(brownian_bridge_sf(crit), c(0.1, 0.05, 0.01, 0.001),
+               tolerance=0.005)
+  expect_equal(brownian_bridge_sf(crit), brownian_bridge_sf(crit, 0),
+               tolerance=1e-6)
+  expect_equal(brownian_bridge_sf(c(0.1, 2, 20), 1e-3),
+               brownian_bridge_sf(c(0.1, 2, 20), 0), tolerance=1e-3)
+  expect_equal(brownian_bridge_sf(c(-1, 0, NA, 1e3)), c(1, 1, NA, 0))
+  expect_true(all(diff(brownian_bridge_sf(seq(0, 5, by=0.01))) < 0))
+  expect_error(brownian_bridge_sf(1, -1))
+})
+
+test_that("brownian_bridge_write_table", {
+  skip_if_not_exported()
+  v <- seq(0, 10, by=0.013)
+  computed <- brownian_bridge_sf(v, 1e-4)
+  table <- tempfile(fileext=".bin")
+  expect_gt(brownian_bridge_write_table(table, 1e-4), 100)
+  brownian_bridge_sf(v, 1e-6)   # drop the computed table
+  expect_identical(brownian_bridge_sf(v, 1e-4, table), computed)
+  # tables of another precision are not used
+  expect_equal(brownian_bridge_sf(v, 1e-3, table), brownian_bridge_sf(v, 0),
+               tolerance=1e-3)
+  unlink(table)
+  installed <- system.file("extdata", "brownian_bridge_sf.bin",
+                           package="waddR")
+  expect_true(file.exists(installed))
+  expect_equal(brownian_bridge_sf(v, 1e-6, installed),
+               brownian_bridge_sf(v, 0), tolerance=1e-6)
+})
+
+#### generalized Pareto distribution
+test_that("gpd_fit", {
+  skip_if_not_exported()
+  set.seed(24)
+  rgpd <- function(n, scale, shape) scale * ((1 - runif(n))^(-shape) - 1) / shape
+  for (shape in c(-0.3, 0.2, 0.6)) {
+    fit <- gpd_fit(rgpd(20000, 2, shape))
+    expect_named(fit, c("scale", "shape"))
+    expect_equal(unname(fit), c(2, shape), tolerance=0.05, scale=1)
+  }
+  # the fit maximizes the likelihood
+  y <- rgpd(300, 1, 0.1)
+  loglik <- function(par) sum(-log(par[1])
+                              - (1/par[2] + 1) * log1p(par[2] * y / par[1]))
+  fit <- gpd_fit(y)
+  for (d in list(c(0.01, 0), c(-0.01, 0), c(0, 0.01), c(0, -0.01)))
+    expect_gt(loglik(fit), loglik(fit + d))
+  expect_error(gpd_fit(1))
+})
+
+test_that("gpd_ad_test", {
+  skip_if_not_exported()
+  set.seed(24)
+  pvals <- replicate(200, gpd_ad_test(rexp(250, 3))[["p.value"]])
+  expect_equal(mean(pvals < 0.05), 0.05, tolerance=0.05, scale=1)
+  expect_equal(mean(pvals < 0.5), 0.5, tolerance=0.1, scale=1)
+  res <- gpd_ad_test(rexp(250))
+  expect_named(res, c("statistic", "p.value", "scale", "shape"))
+  # a sample far from a GPD
+  expect_lt(gpd_ad_test(c(rexp(125), runif(125, 1, 2)))[["p.value"]], 0.05)
+  # no maximum likelihood estimate with shape >= -1
+  expect_error(gpd_ad_test(runif(250, 10, 11)))
+})
+
+test_that("gpd_fitted_pvalue", {
+  skip_if_not_exported()
+  set.seed(24)
+  distr <- sort(rexp(10000), decreasing=TRUE)
+  res <- gpd_fitted_pvalue(6, distr[1:251], 10000)
+  expect_named(res, c("pvalue.gpd", "ad.pval", "N.exc"))
+  expect_true(res[["ad.pval"]] > 0.05)
+  expect_true(res[["N.exc"]] %in% seq(250, 10, by=-10))
+  expect_equal(res[["pvalue.gpd"]], exp(-6), tolerance=0.6)
+  expect_identical(.gpdFittedPValue(6, distr[1:251], 10000), res)
+  expect_error(gpd_fitted_pvalue(6, distr[1:100], 10000))
+})
+
+
+test_that("profile_clock", {
+  skip_if_not_exported()
+  t1 <- profile_clock()
+  Sys.sleep(0.01)
+  t2 <- profile_clock()
+  expect_true(t2 - t1 >= 0.009)
+  expect_true(is.na(profile_peak_rss()) || profile_peak_rss() > 0)
+})
@@ -158,6 +158,146 @@ test_that("wasserstein_metric correctness", {
                                    p=2) **2
                                return(w)})
   expect_equal(wass_metric.values, wass1d.values)
+
+  # zero-inflated samples, where the zeros are kept as one atom
+  set.seed(42)
+  a4 <- c(rep(0, 70), rnorm(20, 1), -rexp(10))
+  b4 <- c(rep(0, 35), rpois(15, 2))
+  b5 <- c(rep(0, 90), rpois(10, 3))
+  expect_equal(wasserstein_metric(a4, b4, p), wasserstein1d(a4, b4, p))
+  expect_equal(wasserstein_metric(a4, b5, p), wasserstein1d(a4, b5, p))
+  expect_equal(wasserstein_metric(b4, a4), wasserstein1d(b4, a4))
+  expect_equal(wasserstein_metric(rep(0, 10), rep(0, 7), p), 0)
+})
+
+
+# test the weighted computation
+test_that("wasserstein_metric with weights", {
+  set.seed(42)
+  a <- sort(rnorm(50))
+  b <- sort(rexp(80))
+  wa <- rpois(50, 3) + 1
+  wb <- runif(80)
+  wb[c(3, 40)] <- 0
+  for (p in c(1, 2, 1.5)) {
+    expect_equal(wasserstein_metric(a, b, p, wa_=wa, wb_=wb),
+                 wasserstein1d(a, b, p, wa=wa, wb=wb))
+    expect_equal(wasserstein_metric(a, b, p, wa_=wa),
+                 wasserstein1d(a, b, p, wa=wa))
+    expect_equal(wasserstein_metric(a, b, p, wb_=wb),
+                 wasserstein1d(a, b, p, wb=wb))
+  }
+  # unit weights give the unweighted distance
+  expect_equal(wasserstein_metric(a, b, 2, wa_=rep(1, 50)),
+               wasserstein_metric(a, b, 2))
+  expect_error(wasserstein_metric(a, b, wa_=rep(1, 49)))
+})
+
+
+# test distances between prepared samples
+test_that("wasserstein_metric with prepared samples", {
+  set.seed(24)
+  a <- rnorm(120)
+  b <- c(rep(0, 60), rpois(90, 2))
+  c <- rexp(120)
+  pa <- prepare_sample(a)
+  pb <- prepare_sample(b)
+  expect_s3_class(pa, "prepared_sample")
+  for (p in c(1, 2, 1.5)) {
+    expect_identical(wasserstein_metric(pa, pb, p), wasserstein_metric(a, b, p))
+    expect_identical(wasserstein_metric(pa, c, p), wasserstein_metric(a, c, p))
+    expect_identical(wasserstein_metric(b, pa, p, collapse_ties=TRUE),
+                     wasserstein_metric(b, a, p, collapse_ties=TRUE))
+  }
+  expect_identical(wasserstein_metric(pa, pb, 2, wa_=seq_len(120)),
+                   wasserstein_metric(a, b, 2, wa_=seq_len(120)))
+  expect_identical(squared_wass_decomp(pa, pb), squared_wass_decomp(a, b))
+  expect_identical(squared_wass_approx(c, pb), squared_wass_approx(c, b))
+  expect_error(prepare_sample(numeric(0)))
+  expect_error(wasserstein_metric(pa, pb, 2, wa_=rep(1, 10)))
+})
+
+
+# quantile sketches are exact for small samples and within the rank error
+# of epsilon for large ones; the moments are always exact
+test_that("Quantile sketches", {
+  set.seed(24)
+  a <- rnorm(2000)
+  b <- c(rep(0, 600), rpois(900, 2))
+  sa <- sketch_sample(a)
+  sb <- sketch_sample(b)
+  expect_s3_class(sa, "quantile_sketch")
+  # same quantiles, moments up to the order of summation
+  expect_equal(squared_wass_decomp(sa, sb), squared_wass_decomp(a, b))
+  expect_identical(squared_wass_approx(sa, b), squared_wass_approx(a, b))
+  expect_equal(squared_wass_decomp(merge_sketches(sketch_sample(a[1:700]),
+                                                  sketch_sample(a[701:2000])),
+                                   b),
+               squared_wass_decomp(a, b))
+
+  x <- rnorm(2e5)
+  y <- rgamma(2e5, 2)
+  exact <- squared_wass_decomp(x, y)
+  for (sx in list(sketch_sample(x), sketch_sample(x, threads=4),
+                  merge_sketches(sketch_sample(x[1:5e4]),
+                                 sketch_sample(x[-(1:5e4)])))) {
+    approx <- squared_wass_decomp(sx, sketch_sample(y))
+    expect_equal(approx$location, exact$location)
+    expect_equal(approx$size, exact$size)
+    expect_equal(approx$distance, exact$distance, tolerance=0.01)
+    expect_equal(approx$shape, exact$shape, tolerance=0.1)
+  }
+  expect_equal(squared_wass_approx(sketch_sample(x, epsilon=0.01), y),
+               squared_wass_approx(x, y), tolerance=0.05)
+  expect_identical(squared_wass_decomp(sketch_sample(x), y),
+                   squared_wass_decomp(sketch_sample(x), y))
+
+  expect_error(sketch_sample(numeric(0)))
+  expect_error(sketch_sample(x, epsilon=0))
+  expect_error(merge_sketches(sa, a))
+  expect_error(wasserstein_metric(sa, b, 2))
+})
+
+
+# test the specialized kernels of the orders 1 and 2 against the generic order
+test_that("wasserstein_metric of orders 1 and 2", {
+  set.seed(24)
+  for (n in c(1, 7, 8, 9, 1001)) {
+    a <- rnorm(n)
+    b <- rexp(n)
+    b2 <- rexp(n + 3)
+    for (p in c(1, 2, 1.5)) {
+      expect_equal(wasserstein_metric(a, b, p),
+                   mean(abs(sort(b) - sort(a))^p)^(1/p))
+      expect_equal(wasserstein_metric(a, b2, p), wasserstein1d(a, b2, p))
+    }
+    # runs of zeros that start and end within the partial sums
+    z <- c(rep(0, n), a)
+    w <- c(-b, rep(0, n %/% 2), b[seq_len(n - n %/% 2)])
+    expect_equal(wasserstein_metric(z, w, 2),
+                 sqrt(mean((sort(w) - sort(z))^2)))
+  }
+})
+
+
+# test the tie-collapsed computation for count data
+test_that("wasserstein_metric with collapsed ties", {
+  set.seed(24)
+  a <- rpois(500, 2)
+  b <- rpois(340, 3)
+  b2 <- rnbinom(500, 1, 0.3)
+  c <- round(rnorm(200), 1)
+  for (p in c(1, 2, 1.5)) {
+    expect_equal(wasserstein_metric(a, b, p, collapse_ties=TRUE),
+                 wasserstein1d(a, b, p))
+    expect_equal(wasserstein_metric(a, b2, p, collapse_ties=TRUE),
+                 wasserstein1d(a, b2, p))
+    expect_equal(wasserstein_metric(c, a, p, collapse_ties=TRUE),
+                 wasserstein1d(c, a, p))
+  }
+  expect_equal(wasserstein_metric(c(3, 1), c(1, 3, 1, 3), 2,
+                                  collapse_ties=TRUE), 0)
+  expect_error(wasserstein_metric(a, b, wa_=rep(1, 500), collapse_ties=TRUE))
 })
 
 
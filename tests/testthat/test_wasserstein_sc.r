@@ -54,6 +54,12 @@ sce.b <- SingleCellExperiment(assays=list(counts=matrix(y, nrow=1)))
 sce.a2 <- SingleCellExperiment(assays=list(counts=matrix(z, nrow=1)))
 sce.b2 <- SingleCellExperiment(assays=list(counts=matrix(z2, nrow=1)))
 
+# matrix input of 20 genes with many zeros in 60 cells, dense and sparse
+set.seed(24)
+dense <- matrix(rnbinom(20*60, 1, 0.7), nrow=20) * 0.25
+sparse <- Matrix::Matrix(dense, sparse=TRUE)
+cond <- c(rep("A", 25), rep("B", 35))
+
 test_that("Correctness of wasserstein single cell output", {
     
     # these are the fields of the two stage output that don't depend on random
@@ -210,3 +216,178 @@ test_that("Example run wasserstein single cell", {
     expect_equal(   colnames(wasserstein.sc(sce.a, sce.b2, permnum=10)),
                     ts.names)
 })
+
+
+test_that("Sequential permutation procedure in wasserstein single cell", {
+    res.seq <- wasserstein.sc(dat, condition1, "OS", permnum=10000, seed=24,
+                              seq.h=10)
+    expect_equal(colnames(res.seq), os.names)
+    expect_true(res.seq[, "pval"] >= 10/10000)
+    expect_equal(res.seq[, 1:8], wasserstein.sc(dat, condition1, "OS",
+                                                permnum=10, seed=24)[, 1:8])
+})
+
+
+test_that("Adaptive permutation budget in wasserstein single cell", {
+    res.ada <- wasserstein.sc(dat, condition1, "OS", permnum=10000, seed=24,
+                              alpha=0.05)
+    expect_equal(colnames(res.ada), c(os.names, "num.perm"))
+    expect_true(res.ada[, "num.perm"] >= 256)
+    expect_true(res.ada[, "num.perm"] <= 10000)
+    expect_equal(res.ada[, 1:8], wasserstein.sc(dat, condition1, "OS",
+                                                permnum=10, seed=24)[, 1:8])
+    res.ada <- wasserstein.sc(dat, condition1, "TS", permnum=1000, seed=24,
+                              alpha=0.05)
+    expect_equal(colnames(res.ada), c(ts.names, "num.perm"))
+})
+
+
+test_that("Shared permutations in wasserstein single cell", {
+    res.shared <- wasserstein.sc(dense, cond, "OS", permnum=1000, seed=24,
+                                 shared.perm=TRUE)
+    res <- wasserstein.sc(dense, cond, "OS", permnum=1000, seed=24)
+    expect_equal(colnames(res.shared), os.names)
+    expect_equal(res.shared[, 1:8], res[, 1:8])
+    expect_true(all(res.shared[, "pval"] >= 0 & res.shared[, "pval"] <= 1))
+    expect_equal(wasserstein.sc(dense, cond, "OS", permnum=1000, seed=24,
+                                shared.perm=TRUE), res.shared)
+    expect_equal(wasserstein.sc(sparse, cond, "OS", permnum=1000, seed=24,
+                                shared.perm=TRUE),
+                 res.shared)
+    expect_error(wasserstein.sc(dense, cond, "TS", permnum=100,
+                                shared.perm=TRUE))
+})
+
+
+test_that("testZeroes agrees with bayesglm", {
+    skip_if_not_installed("arm")
+    # a gene without zeros
+    d <- dense
+    d[3, ] <- d[3, ] + 1
+    detection <- colSums(d > 0) / nrow(d)
+    pval <- vapply(seq_len(nrow(d)), function(j) {
+        trow <- d[j, ]
+        if (sum(trow == 0) == 0) return(NA_real_)
+        M1 <- suppressWarnings(
+                arm::bayesglm(trow > 0 ~ detection + factor(cond),
+                              family=binomial(link="logit"), Warning=FALSE))
+        summary(M1)$coefficients[3, 4]
+    }, numeric(1))
+
+    expect_true(is.na(testZeroes(d, cond)[3]))
+    expect_equal(testZeroes(d, cond), pval, tolerance=1e-6)
+    expect_equal(testZeroes(d, rev(cond)),
+                 testZeroes(d[, 60:1], cond)[seq_len(20)])
+})
+
+
+test_that("Sparse input of wasserstein single cell and testZeroes", {
+    expect_equal(testZeroes(sparse, cond), testZeroes(dense, cond))
+    expect_equal(testZeroes(sparse, cond, these=c(2, 5)),
+                 testZeroes(dense, cond, these=c(2, 5)))
+    expect_equal(wasserstein.sc(sparse, cond, "TS", permnum=100, seed=24),
+                 wasserstein.sc(dense, cond, "TS", permnum=100, seed=24))
+    expect_equal(wasserstein.sc(sparse, cond, "OS", permnum=100, seed=24),
+                 wasserstein.sc(dense, cond, "OS", permnum=100, seed=24))
+})
+
+
+test_that("Block streaming of wasserstein single cell and testZeroes", {
+    skip_if_not_installed("DelayedArray")
+    for (delayed in list(DelayedArray::DelayedArray(dense),
+                         DelayedArray::DelayedArray(sparse))) {
+        expect_equal(testZeroes(delayed, cond, block.size=7),
+                     testZeroes(dense, cond))
+        expect_equal(testZeroes(delayed, cond, these=c(5, 2), block.size=1),
+                     testZeroes(dense, cond, these=c(5, 2)))
+        expect_equal(wasserstein.sc(delayed, cond, "TS", permnum=100,
+                                    seed=24, block.size=7),
+                     wasserstein.sc(dense, cond, "TS", permnum=100, seed=24))
+        expect_equal(wasserstein.sc(delayed, cond, "OS", permnum=100,
+                                    seed=24, block.size=7),
+                     wasserstein.sc(dense, cond, "OS", permnum=100, seed=24))
+    }
+})
+
+
+test_that("Checkpointed wasserstein single cell", {
+    for (method in c("TS", "OS")) {
+        res <- wasserstein.sc(dense, cond, method, permnum=100, seed=24)
+
+        file <- tempfile(fileext=".bin")
+        expect_equal(wasserstein.sc(dense, cond, method, permnum=100,
+                                    seed=24, block.size=7, checkpoint=file),
+                     res)
+
+        # cut the file within the records of the second block, as an
+        # interruption would, and resume the run
+        bytes <- readBin(file, "raw", file.size(file))
+        writeBin(bytes[seq_len(length(bytes) - 10 * 128 - 50)], file)
+        expect_equal(wasserstein.sc(dense, cond, method, permnum=100,
+                                    seed=24, block.size=7, checkpoint=file),
+                     res)
+        expect_equal(file.size(file), length(bytes))
+        expect_error(wasserstein.sc(dense, cond, method, permnum=10,
+                                    seed=24, checkpoint=file))
+        # same group sizes, but two cells swap their conditions
+        swapped <- replace(cond, c(2, 60), cond[c(60, 2)])
+        expect_error(wasserstein.sc(dense, swapped, method, permnum=100,
+                                    seed=24, block.size=7, checkpoint=file))
+        expect_error(wasserstein.sc(dense[-1, ], cond, method, permnum=100,
+                                    seed=24, block.size=7, checkpoint=file))
+        unlink(file)
+    }
+})
+
+
+test_that("checkpoint_open", {
+    skip_if_not_exported()
+    file <- tempfile()
+    names <- c("a", "pval")
+    expect_equal(checkpoint_open(file, 3, names, "run"), rep(FALSE, 3))
+    expect_equal(checkpoint_append(file, c(3L, 1L),
+                                   matrix(c(1, 2, 0.01, NA), nrow=2)), 2)
+    expect_equal(checkpoint_open(file, 3, names, "run"), c(TRUE, FALSE, TRUE))
+    expect_error(checkpoint_open(file, 3, names, "other run"))
+    expect_error(checkpoint_collect(file, 2))
+
+    # an incomplete record at the end is removed on reopening
+    con <- file(file, "ab")
+    writeBin(as.raw(1:5), con)
+    close(con)
+    expect_equal(checkpoint_open(file, 3, names, "run"), c(TRUE, FALSE, TRUE))
+    checkpoint_append(file, 2L, matrix(c(3, 0.04), nrow=1))
+
+    p.zero <- c(0.5, NA, 0.2)
+    res <- checkpoint_collect(file, 2, p.zero)
+    expect_equal(unname(res$values), cbind(c(2, 3, 1), c(NA, 0.04, 0.01)))
+    expect_equal(colnames(res$values), names)
+    expect_equal(res$p.adj, p.adjust(c(NA, 0.04, 0.01), method="BH"))
+    expect_identical(res$p.combined,
+                     .combinePVal(c(NA, 0.04, 0.01), p.zero))
+    expect_equal(res$p.adj.zero, p.adjust(p.zero, method="BH"))
+    expect_equal(res$p.adj.combined,
+                 p.adjust(.combinePVal(c(NA, 0.04, 0.01), p.zero),
+                          method="BH"))
+    unlink(file)
+})
+
+
+test_that("Profiling of wasserstein single cell", {
+    for (method in c("TS", "OS")) {
+        res <- wasserstein.sc(dense, cond, method, permnum=100, seed=24)
+        res.prof <- wasserstein.sc(dense, cond, method, permnum=100, seed=24,
+                                   profile=TRUE)
+        prof <- attr(res.prof, "profile")
+        attr(res.prof, "profile") <- NULL
+        expect_equal(res.prof, res)
+
+        expect_equal(nrow(prof$genes), 20)
+        expect_true(all(prof$genes[, c("stats.s", "perm.s", "gpd.s")] >= 0))
+        expect_true(all(prof$genes$num.perm %in% c(0, 100)))
+        expect_equal(sum(prof$workers$genes), 20)
+        expect_equal(sum(prof$workers$busy.s),
+                     sum(prof$genes[, c("stats.s", "perm.s", "gpd.s")]))
+        expect_equal(names(prof$stages), c("tests", "zeroes", "adjustment"))
+    }
+})
@@ -47,3 +47,57 @@ test_that("Example Run of Wasserstein Test", {
                expected=names.sp, ignore.order=TRUE)
 
 })
+
+
+test_that("Reproducibility of wasserstein test across thread counts", {
+  set.seed(42)
+  x <- rnorm(200, 0, 1)
+  y <- rnorm(180, 0.3, 1.2)
+
+  set.seed(7)
+  res.single <- wasserstein.test(x, y, method="SP", permnum=2000, threads=1)
+  set.seed(7)
+  res.multi <- wasserstein.test(x, y, method="SP", permnum=2000, threads=4)
+  expect_identical(res.single, res.multi)
+})
+
+
+test_that("Sequential permutation procedure of wasserstein test", {
+  set.seed(42)
+  x <- rnorm(100)
+  y <- rnorm(100)
+  y.shifted <- rnorm(100, 2)
+
+  # a null sample stops early with the p-value of Besag and Clifford
+  set.seed(3)
+  res.seq <- wasserstein.test(x, y, method="SP", permnum=10000, seq.h=10)
+  expect_true(res.seq["pval"] > 10/10000)
+  expect_true(is.na(res.seq["p.ad.gpd"]))
+
+  # a sample that stays in the tail is evaluated with all permutations
+  set.seed(3)
+  res.full <- wasserstein.test(x, y.shifted, method="SP", permnum=1000)
+  set.seed(3)
+  res.seq <- wasserstein.test(x, y.shifted, method="SP", permnum=1000,
+                              seq.h=10)
+  expect_identical(res.full, res.seq)
+})
+
+
+test_that("Sequential procedure reaching seq.h at the last permutation", {
+  skip_if_not_exported()
+  set.seed(42)
+  x <- rnorm(100)
+  y <- rnorm(100, 0.3)
+  value.sq <- wasserstein.test(x, y, method="SP", permnum=100)[["d.wass^2"]]
+  set.seed(3)
+  stats <- wass_permutations(x, y, 10000)
+  last <- which(cumsum(stats >= value.sq) == 3)[1]
+  expect_false(is.na(last))
+
+  # Besag and Clifford p-value h / L instead of the GPD approximation
+  set.seed(3)
+  res <- wasserstein.test(x, y, method="SP", permnum=last, seq.h=3)
+  expect_equal(res[["pval"]], 3 / last)
+  expect_true(is.na(res[["p.ad.gpd"]]))
+})